@@ -1,22 +1,195 @@
 #include <iostream>
 #include <fstream>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <new>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <limits>
 #include <raylib.h>
+#include <rlgl.h>
 using namespace std;
 
+// Memory mapping for the asset pack and UDP sockets for netplay. The
+// Windows headers come after raylib with GDI/USER left out, or their
+// Rectangle, CloseWindow, DrawText and LoadImage would collide with raylib's.
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOGDI
+#define NOUSER
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+typedef SOCKET NetSocket;
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+typedef int NetSocket;
+#endif
+
+// SIMD level for the entity kernels. AVX2 builds use 8-wide paths, any
+// x86-64 build has SSE2; everything else falls back to scalar loops.
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SIMD_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SIMD_SSE2 1
+#endif
+#if defined(SPACE_BENCHMARK) && !defined(_MSC_VER) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
+
+// Identifies the simulation build in replay headers. Build scripts can pass
+// -DSPACE_BUILD_ID="<commit>" for something steadier than the compile time.
+#ifndef SPACE_BUILD_ID
+#define SPACE_BUILD_ID __DATE__ " " __TIME__
+#endif
+
 // Game constants
 const int SCREEN_WIDTH = 800;
 const int SCREEN_HEIGHT = 600;
-const int MAX_ENEMIES = 30;
-const int MAX_BULLETS = 10;
-const int MAX_BOSS_BULLETS = 20;
 const int MAX_LEVEL = 5;
+const int INITIAL_GAME_EVENTS = 64;
+
+// Entity capacities. These are the defaults; --max-enemies, --max-bullets
+// and --max-boss-bullets size the level arena at startup instead.
+const int DEFAULT_MAX_ENEMIES = 30;
+const int DEFAULT_MAX_BULLETS = 10;
+const int DEFAULT_MAX_BOSS_BULLETS = 4096;      // room for the densest boss phase
+const int MAX_ENTITY_CAPACITY = 1000000;
+const size_t ARENA_ALIGN = 64;                  // every arena block starts on a cache line
+
+// Binary snapshots: 16-byte header, then 4-byte fields (see SerializeSnapshot
+// and SnapshotMaxBytes)
+const unsigned int SNAPSHOT_MAGIC = 0x56495053;    // "SPIV"
+const unsigned int SNAPSHOT_VERSION = 3;
+const int SNAPSHOT_HEADER_BYTES = 16;
+const int SNAPSHOT_FIXED_FIELDS = 3 + 21 + 9 + 11;  // counts, GameState + RNG, Player, Boss
+
+// Replays: 32-byte header (entity capacities included, as they change how
+// the game plays), then (input byte, varint run length) pairs.
+// Input bytes only use the low 6 bits, so 0xFF can mark a snapshot chunk.
+const unsigned int REPLAY_MAGIC = 0x50525053;      // "SPRP"
+const unsigned int REPLAY_VERSION = 4;
+const int REPLAY_SNAPSHOT_MARKER = 0xFF;
+const unsigned char HELD_INPUT_BITS = 3;        // left | right are held keys; the other bits are presses
+
+// Netplay (--net-player 1|2): the two instances only exchange inputs over
+// UDP. Each side predicts the other's input and rolls back when it was wrong.
+const unsigned int NET_MAGIC = 0x504E5053;         // "SPNP"
+const int NET_BASE_PORT = 7000;                 // player N listens on NET_BASE_PORT + N by default
+const int ROLLBACK_WINDOW = 16;                 // ticks a side may run past the last confirmed remote input
+const int ROLLBACK_STATES = ROLLBACK_WINDOW + 2;
+const int NET_INPUT_RING = 128;                 // > 2 * ROLLBACK_WINDOW, the most inputs ever in flight
+const int NET_MAX_PACKET_INPUTS = 64;
+const int NET_MAX_PACKET = 20 + NET_MAX_PACKET_INPUTS;
+const int NET_MAX_PENDING = 256;                // packets held back by --net-delay / --net-jitter
+const int NET_CONNECT_TIMEOUT_MS = 30000;
+const float PARTNER_OFFSET_X = 120.0f;          // player 2 spawns this far right of player 1
+
+// Render frames: index of the middle slot plus a bit set while the
+// renderer hasn't taken it yet
+const int RENDER_FRAME_FRESH = 4;
+
+// Background asset loading
+const int MAX_ASSET_JOBS = 16;
+const int SOUND_FILE_COUNT = 5;
+
+// Asset packs (--pack): a header of 4-byte fields, then the RGBA atlas and
+// each sound as 32-bit float stereo PCM, every block 64-byte aligned
+const char* const ASSET_PACK_FILE = "assets.pak";
+const unsigned int ASSET_PACK_MAGIC = 0x4B415053;  // "SPAK"
+const unsigned int ASSET_PACK_VERSION = 1;
+const int ASSET_PACK_ALIGN = 64;
+
+// Sound voices: how many sounds may play at once (--voices)
+const int MAX_VOICES = 32;
+const int DEFAULT_VOICES = 8;
+
+// Cached render layers: each HUD line is baked into its own small render
+// texture, menus into one full-screen texture
+const int HUD_FONT_SIZE = 20;
+const int HUD_TEXT_WIDTH = 256;
+const int HUD_TEXT_HEIGHT = 24;
+
+// Particles (explosions, muzzle flashes, hit sparks)
+const int MAX_PARTICLES = 100000;
+const float PARTICLE_GRAVITY = 240.0f;      // px/s^2
+const float PARTICLE_DRAG = 2.0f;           // fraction of velocity lost per second
+const int PARTICLE_DRAW_CHUNK = 2048;       // quads per rlBegin; rlgl's smallest default batch
+
+// Frame profiler
+const int PROFILE_RING_SIZE = 1 << 16;      // samples kept; must be a power of two
+const int PROFILE_WINDOW_FRAMES = 120;      // frames (or ticks) covered by the overlay stats
+const int PROFILE_THREADS = 2;              // render thread (trace tid 1) and simulation thread (tid 2)
+
+// Broadphase grid cell size; must be at least as large as any entity kept in a grid
+const float GRID_CELL_SIZE = 80.0f;
+const int MAX_QUERY_RESULTS = 4096;
+const int OVERLAP_BATCH = 32;   // candidates gathered per narrowphase batch
+
+// Benchmarks spread entities at the density of a full 30-enemy screen
+const float BENCH_AREA_PER_ENTITY = (SCREEN_WIDTH * SCREEN_HEIGHT) / 30.0f;
+const unsigned int BENCH_SEED = 1;
+const int BENCH_CAPACITY = 100000;              // room for the largest microbenchmark counts
+
+// Entity sizes (every enemy and bullet is the same size)
+const int ENEMY_WIDTH = 80;
+const int ENEMY_HEIGHT = 80;
+const int BULLET_WIDTH = 30;
+const int BULLET_HEIGHT = 30;
+const int BOSS_BULLET_SIZE = 12;                // boss bullets are smaller, and square
+
+// Band that wave layouts place enemy top-left corners in, and the number of
+// cells in the layout grid over it (one enemy footprint per cell)
+const int WAVE_MIN_X = SCREEN_WIDTH / 2 - 250;
+const int WAVE_MAX_X = SCREEN_WIDTH / 2 + 250 - ENEMY_WIDTH;
+const int WAVE_MIN_Y = 60;
+const int WAVE_MAX_Y = 220;
+const int WAVE_LAYOUT_CELLS = ((WAVE_MAX_X - WAVE_MIN_X) / ENEMY_WIDTH + 1) *
+    ((WAVE_MAX_Y - WAVE_MIN_Y) / ENEMY_HEIGHT + 1);
+
+// Simulation timing. Speeds below are in pixels per second.
+const int DEFAULT_TICK_RATE = 60;
+const int DEFAULT_MAX_CATCH_UP_STEPS = 5;
+const float PLAYER_SPEED = 300.0f;
+const float BULLET_SPEED = 480.0f;
+
+// Boss pattern scripts (see RunBossPattern)
+const float BOSS_PHASE_PAUSE = 0.8f;            // quiet time when a new phase starts
+const int MAX_PATTERN_STEPS_PER_TICK = 64;      // a script that never waits can't hang a tick
+
+// Sprite atlas
+const int ATLAS_WIDTH = 1024;
+const int ATLAS_PADDING = 2;
 
 // Boss constants
 const int BOSS_WIDTH = 200;
 const int BOSS_HEIGHT = 200;
-const float BOSS_SPEED = 2.0f;
+const float BOSS_SPEED = 120.0f;
 const int BOSS_INITIAL_HEALTH = 100;
 
+// Balance sweeps
+const int BALANCE_STAGES = MAX_LEVEL + 1;           // levels 1..MAX_LEVEL, then the boss
+const int BALANCE_MAX_GAME_SECONDS = 600;           // longer games count as timeouts
+
 // Game states
 enum GameStateEnum {
     STATE_MENU,
@@ -30,6 +203,8 @@ enum GameStateEnum {
 struct Player {
     float x;
     float y;
+    float prevX;    // position at the start of the last tick, for render interpolation
+    float prevY;
     int width;
     int height;
     float speed;
@@ -37,34 +212,132 @@ struct Player {
     bool isAlive;
 };
 
-struct Enemy {
-    float x;
-    float y;
-    int width;
-    int height;
-    float speed;
-    int health;
-    bool active;
+// Enemies and bullets are stored as structure-of-arrays columns carved
+// from the level arena, each one ARENA_ALIGN-aligned.
+struct EnemyColumns {
+    float* x;
+    float* y;
+    float* prevY;
+    float* speed;
+    int* health;
 };
 
-struct Bullet {
-    float x;
-    float y;
-    int width;
-    int height;
-    float speed;
-    bool active;
+struct BulletColumns {
+    float* x;
+    float* y;
+    float* prevY;
+};
+
+// Boss bullets fly in any direction, so they carry a velocity
+struct BossBulletColumns {
+    float* x;
+    float* y;
+    float* prevX;
+    float* prevY;
+    float* vx;
+    float* vy;
+};
+
+// Fixed-capacity pool over a column block. Live objects are packed in
+// [0, count) so update passes iterate densely and never test an "active"
+// flag; releasing swaps the last object into the hole. The capacity is set
+// at startup and every array lives in the level arena.
+template <class Columns>
+struct Pool {
+    Columns cols;
+    int count;
+    int capacity;
+    unsigned char* keep;    // scratch for compaction passes
+    int* found;             // scratch for grid query results
+};
+
+typedef Pool<EnemyColumns> EnemyPool;
+typedef Pool<BulletColumns> BulletPool;
+typedef Pool<BossBulletColumns> BossBulletPool;
+
+struct EntityCapacities {
+    int enemies;
+    int bullets;
+    int bossBullets;
+};
+
+// Bump allocator for everything sized by the entity capacities. A level's
+// pools are carved out of it and the whole arena is reset when the level
+// is torn down, so nothing is allocated per entity or per level.
+struct Arena {
+    unsigned char* memory;      // as allocated
+    unsigned char* base;        // memory rounded up to ARENA_ALIGN; NULL when only measuring
+    size_t capacity;
+    size_t used;
 };
 
 struct Boss {
     float x;
     float y;
-    int width;
-    int height;
+    float prevX;
     float speed;
     int health;
     bool active;
-    float shootTimer;
+    float shootTimer;       // seconds until the pattern script runs again
+    int phase;              // index into BOSS_PHASES
+    int pc;                 // next step in BOSS_PATTERN
+    int loopsLeft;          // passes left in the current PATTERN_LOOP, 0 = none
+    float spin;             // rotation applied to rings and fans (radians)
+};
+
+// Boss bullet patterns are small scripts in BOSS_PATTERN. Every step runs
+// in order until a PATTERN_WAIT; angles are in radians, 0 = right and
+// PI / 2 = straight down.
+enum PatternOp {
+    PATTERN_FAN,            // count bullets over an arc of value, centered below the boss (turned by spin)
+    PATTERN_AIMED,          // count bullets over an arc of value, centered on the player
+    PATTERN_RING,           // count bullets evenly around a circle, starting at spin
+    PATTERN_SPIN,           // spin += value
+    PATTERN_FACE,           // spin = value
+    PATTERN_WAIT,           // pause for value seconds
+    PATTERN_LOOP,           // back to target until count passes are done (loops don't nest)
+    PATTERN_JUMP            // continue at target
+};
+
+struct PatternStep {
+    PatternOp op;
+    int count;
+    float value;
+    float speed;            // bullet speed in pixels per second
+    int target;
+};
+
+// A phase starts once the boss's health drops to healthFraction of the
+// maximum and runs its script from step start.
+struct BossPhase {
+    float healthFraction;
+    int start;
+};
+
+// PCG32 generator. Each subsystem draws from its own stream, so adding
+// draws to one (say, AI) leaves wave layouts for a given seed unchanged.
+struct Rng {
+    unsigned long long state;
+    unsigned long long inc;     // stream selector, always odd
+};
+
+enum RngStream {
+    RNG_WAVE_LAYOUT,
+    RNG_SPEED_JITTER,
+    RNG_AI,
+    RNG_STREAM_COUNT
+};
+
+// Difficulty knobs. They tune a session rather than describe its state, so
+// snapshots leave them alone.
+struct BalanceParams {
+    int enemiesBase;        // wave size = enemiesBase + level * enemiesPerLevel
+    int enemiesPerLevel;
+    float speedBase;        // enemy speed = speedBase + level * speedPerLevel (px/s)
+    float speedPerLevel;
+    int scorePerLevel;      // next level once score >= level * scorePerLevel
+    int hitsPerWave;        // added to hitsToKill when a wave is cleared early
+    int bossHealth;
 };
 
 struct GameState {
@@ -76,356 +349,5136 @@ struct GameState {
     bool gameWon;
     GameStateEnum gameState;
     bool bossActive;
+    unsigned int seed;              // the streams below started from this
+    Rng rng[RNG_STREAM_COUNT];
+    BalanceParams balance;
+};
+
+// Every sprite lives in one atlas texture. SPRITE_WHITE is a solid block
+// used for the plain rectangles drawn when an image file is missing.
+enum SpriteId {
+    SPRITE_BACKGROUND,
+    SPRITE_PLAYER,
+    SPRITE_ENEMY,
+    SPRITE_BULLET,
+    SPRITE_BOSS,
+    SPRITE_WHITE,
+    SPRITE_COUNT
+};
+
+struct SpriteAtlas {
+    Texture2D texture;
+    Rectangle regions[SPRITE_COUNT];    // in atlas pixels
+    bool loaded[SPRITE_COUNT];          // false if the image file was missing
+};
+
+// Layers are drawn in this order; within a layer, in submission order.
+enum SpriteLayer {
+    LAYER_BACKGROUND,
+    LAYER_PLAYER,
+    LAYER_ENEMIES,
+    LAYER_BULLETS,
+    LAYER_BOSS,
+    LAYER_BOSS_BULLETS,
+    LAYER_COUNT
+};
+
+struct SpriteCommand {
+    Rectangle dest;
+    unsigned char sprite;
+    unsigned char layer;
+    Color tint;
+};
+
+struct SpriteBatch {
+    vector<SpriteCommand> items;    // sized once by InitSpriteBatch
+    int count;
+    vector<int> order;
+    // Per-frame counters (reset by BeginSpriteBatch)
+    int drawCalls;
+    int batchFlushes;
+};
+
+enum HudText {
+    HUD_SCORE,
+    HUD_LEVEL,
+    HUD_LIVES,
+    HUD_BEST,
+    HUD_BOSS_HEALTH,
+    HUD_TEXT_COUNT
+};
+
+// One line of text baked into a render texture, redrawn only when the
+// value it shows changes
+struct CachedText {
+    RenderTexture2D target;
+    int value;
+    bool baked;
+};
+
+// Static screens and HUD text kept in render textures so a frame blits
+// them instead of submitting every glyph again. The menu screens only
+// depend on the values in the key, so a menu frame is a single blit.
+struct RenderCache {
+    RenderTexture2D screen;
+    bool screenBaked;
+    int screenState;            // key: gameState, score, highScore, scorePerLevel
+    int screenScore;
+    int screenHighScore;
+    int screenScorePerLevel;
+    CachedText hud[HUD_TEXT_COUNT];
+    long long bakes;            // texts and screens redrawn into their textures
+};
+
+// Read-only asset pack bytes, either mapped from disk or built in memory
+struct AssetPack {
+    const unsigned char* data;
+    long long size;
+    bool mapped;
+    vector<unsigned char> memory;       // backing store when not mapped
+};
+
+enum AssetId {
+    ASSET_ATLAS,
+    ASSET_SOUND_SHOOT,                  // sounds in the pack's order
+    ASSET_SOUND_EXPLOSION,
+    ASSET_SOUND_GAME_OVER,
+    ASSET_SOUND_WIN,
+    ASSET_SOUND_PLAYER_HIT,
+    ASSET_COUNT
+};
+const int ASSET_FIRST_SOUND = ASSET_SOUND_SHOOT;
+
+// Each asset is created from the pack on its first acquire and freed when
+// its last reference is released, so every user shares one copy.
+struct ResourceCache {
+    AssetPack pack;
+    Image atlasImage;                   // views into the pack; nothing to free
+    Wave waves[SOUND_FILE_COUNT];
+    int refs[ASSET_COUNT];
+    SpriteAtlas atlas;
+    Sound sounds[SOUND_FILE_COUNT];
+};
+
+// A voice is an alias of a cached sound: it shares the samples but plays
+// on its own, so overlapping explosions no longer cut each other off.
+struct Voice {
+    Sound alias;
+    int sound;              // AssetId aliased, -1 if none yet
+    int priority;
+    long long started;      // play order, for stealing the oldest
+};
+
+struct VoicePool {
+    Voice voices[MAX_VOICES];
+    int limit;
+    long long plays;
+    int steals;             // voices cut short for a more important sound
+    int drops;              // plays skipped because every voice mattered more
 };
 
 struct GameResources {
-    Texture2D playerTexture;
-    Texture2D enemyTexture;
-    Texture2D bulletTexture;
-    Texture2D backgroundTexture;
-    Texture2D bossTexture;
-    Texture2D bossBulletTexture;
-
-    Sound shootSound;
-    Sound explodeSound;
-    Sound gameOverSound;
-    Sound winSound;
-    Sound playerHitSound;
+    ResourceCache cache;    // sounds are played through a VoicePool
+    SpriteAtlas atlas;
     Music gameTheme;
 };
 
+// Explosion debris, muzzle flashes and hit sparks. The simulation never
+// reads these, so they live outside GameWorld and draw from their own
+// stream without touching replays or snapshots. Live particles are packed
+// in [0, count); a dead one is replaced by the last.
+struct ParticleSystem {
+    alignas(32) float x[MAX_PARTICLES];     // centre
+    alignas(32) float y[MAX_PARTICLES];
+    alignas(32) float prevX[MAX_PARTICLES];
+    alignas(32) float prevY[MAX_PARTICLES];
+    alignas(32) float vx[MAX_PARTICLES];
+    alignas(32) float vy[MAX_PARTICLES];
+    alignas(32) float life[MAX_PARTICLES];  // seconds left
+    alignas(32) float size[MAX_PARTICLES];
+    Color color[MAX_PARTICLES];
+    unsigned char keep[MAX_PARTICLES];      // scratch for the cull pass
+    int count;
+    long long drops;                        // spawns skipped while full
+    Rng rng;
+};
+
+// Startup asset loading. CPU decoding runs on worker threads as a small job
+// graph; GPU uploads and audio device calls stay on the main thread.
+struct AssetLoader;
+
+struct AssetJob {
+    void (*run)(AssetLoader& loader, int arg);
+    int arg;
+    int pendingDeps;                    // unfinished jobs this one waits on
+    int dependents[MAX_ASSET_JOBS];
+    int dependentCount;
+};
+
+struct AssetLoader {
+    AssetJob jobs[MAX_ASSET_JOBS];
+    int jobCount;
+
+    // The lock guards the ready queue and every job's pendingDeps
+    mutex lock;
+    condition_variable wake;
+    int ready[MAX_ASSET_JOBS];          // each job is queued exactly once
+    int readyHead;
+    int readyTail;
+    atomic<int> finished;
+    vector<thread> workers;
+
+    const char* spriteFiles[SPRITE_COUNT];
+    int spriteSizes[SPRITE_COUNT][2];
+    Image sprites[SPRITE_COUNT];
+    SpriteAtlas atlas;                  // regions and loaded flags; the texture comes last
+    int atlasHeight;
+    Image atlasImage;
+
+    const char* soundFiles[SOUND_FILE_COUNT];
+    Wave waves[SOUND_FILE_COUNT];
+};
+
+// Per-tick input snapshot. The simulation never reads the keyboard itself,
+// so the same code runs with a window, headless, or from a script.
+struct InputState {
+    bool left;      // held
+    bool right;     // held
+    bool shoot;     // pressed this tick
+    bool newGame;   // N pressed this tick
+    bool loadGame;  // L pressed this tick
+    bool confirm;   // ENTER pressed this tick
+};
+
+// What happened during a tick. Collision passes only push these; the
+// simulation applies score, wins and lost lives when it drains the queue
+// at the end of the tick (ApplyGameEvents), and the frontend then reads
+// the same queue for sounds, music and particles.
+enum GameEventType {
+    EVENT_PLAYER_SHOT,
+    EVENT_BOSS_SHOT,
+    EVENT_ENEMY_HIT,
+    EVENT_ENEMY_KILLED,     // follows the hit that killed it
+    EVENT_BOSS_HIT,
+    EVENT_BOSS_DEFEATED,
+    EVENT_PLAYER_HIT,
+    EVENT_GAME_OVER,
+    EVENT_GAME_RESTARTED,
+    EVENT_GAME_LOADED       // state came from a save file, outside the replay
+};
+
+struct GameEvent {
+    GameEventType type;
+    float x;
+    float y;
+};
+
+// Grows to the busiest tick seen, then stays put
+struct GameEvents {
+    vector<GameEvent> items;
+    int count;
+};
+
+// Uniform grid over the playfield. Entities are bucketed by the cell holding
+// their top-left corner with a counting sort, so a query only needs to look
+// one cell further up and left to catch anything hanging into its range.
+// Positions outside the grid are clamped into the border cells.
+struct SpatialGrid {
+    float originX;
+    float originY;
+    float cellSize;
+    int cols;
+    int rows;
+    int count;
+    float maxStep;          // farthest any entity moved this tick on either axis (MaxStep)
+    vector<int> cellStart;  // cols * rows + 1 prefix offsets into items
+    vector<int> cellOf;     // cell index per entity
+    vector<int> items;      // entity indices ordered by cell
+};
+
+// Grids rebuilt every tick for the collision queries
+struct Broadphase {
+    SpatialGrid enemies;
+    SpatialGrid bossBullets;
+};
+
+// Everything the simulation owns. No raylib handles live in here.
+struct GameWorld {
+    GameState game;
+    Player player;
+    Player partner;         // co-op player 2, only alive when coop is set
+    bool coop;
+    EnemyPool enemies;
+    BulletPool bullets;
+    Boss boss;
+    BossBulletPool bossBullets;
+    Arena arena;            // backs the pools above
+    Broadphase broadphase;
+};
+
+// One --vary axis: a balance parameter and the values it takes
+struct SweepAxis {
+    char param[32];
+    vector<float> values;
+};
+
+// Command line options
+struct GameConfig {
+    bool headless;
+    long long headlessTicks;
+    bool benchBroadphase;
+    int tickRate;           // simulation ticks per second
+    int maxCatchUpSteps;    // ticks run per frame at most before dropping time
+    int targetFps;          // 0 = follow vsync
+    const char* tracePath;  // Chrome trace written here on F4 / exit, or NULL
+    const char* recordPath; // replay recorded here, or NULL
+    const char* playPath;   // replay played back from here, or NULL
+    bool seeded;            // --seed given; otherwise the clock picks one
+    unsigned int seed;
+    const char* sweepPath;  // balance sweep CSV written here, or NULL
+    int sweepGames;         // games per parameter set and bot policy
+    int sweepThreads;       // 0 = one per core
+    vector<SweepAxis> sweepAxes;
+    const char* packPath;   // asset pack written here (then exit), or NULL
+    int voiceLimit;         // sounds playing at once, 1..MAX_VOICES
+    EntityCapacities capacities;
+    int netPlayer;          // 1 or 2 in netplay, 0 = single player
+    int netPort;            // local UDP port
+    const char* netPeer;    // "host:port" or just a port on 127.0.0.1
+    int netDelayMs;         // artificial one-way latency added to every packet
+    int netJitterMs;        // up to this much more, per packet
+    int netLossPercent;     // packets dropped on purpose
+};
+
+// Scripted players for headless runs. rng is the bot's own stream, so a
+// bot that rolls dice doesn't disturb the game's streams.
+typedef void (*BotPolicyFn)(const GameWorld& world, long long tick, float dt, Rng& rng, InputState& input);
+
+struct BotPolicy {
+    const char* name;
+    BotPolicyFn input;
+};
+
+// How one swept game went
+struct GameOutcome {
+    bool won;
+    bool timedOut;
+    long long ticks;
+    long long bossTick;             // first boss fight tick, -1 if never reached
+    int livesLost[BALANCE_STAGES];
+};
+
+// Shared by the sweep workers. Each game writes only its own outcome slot.
+struct BalanceSweep {
+    vector<BalanceParams> balances;     // one per parameter combination
+    const BotPolicy* policies;
+    int policyCount;
+    long long games;                    // per combination and policy
+    long long jobs;
+    unsigned int seed;
+    float dt;
+    long long maxTicks;
+    EntityCapacities capacities;
+    vector<GameOutcome> outcomes;       // indexed by job
+    atomic<long long> nextJob;
+};
+
+// Input replay being written to disk, one run-length record at a time
+struct ReplayWriter {
+    ofstream file;
+    bool active;
+    int runValue;           // packed input of the open run, -1 if none
+    unsigned long long runLength;
+};
+
+struct ReplayReader {
+    ifstream file;
+    bool active;
+    unsigned int seed;
+    int tickRate;
+    unsigned int buildHash;
+    EntityCapacities capacities;
+    int runValue;
+    unsigned long long runLeft;     // ticks left in the current run
+};
+
+struct ReplaySession {
+    ReplayWriter writer;
+    ReplayReader reader;
+};
+
+// Raw copy of everything StepSimulation changes, for rollback. Only the
+// live part of each pool column is copied, into a buffer sized at startup.
+struct WorldState {
+    GameState game;
+    Player player;
+    Player partner;
+    Boss boss;
+    int enemyCount;
+    int bulletCount;
+    int bossBulletCount;
+    vector<unsigned char> columns;
+};
+
+enum NetPacketKind {
+    NET_HELLO,      // seed, tick rate, capacities and build hash (player 1's win)
+    NET_INPUTS      // first tick, input count, ack, then one input byte per tick
+};
+
+struct NetPacket {
+    long long sendAt;       // NetClockMs() time it may go out
+    int size;
+    unsigned char data[NET_MAX_PACKET];
+};
+
+// Connected UDP socket plus the artificial network conditions, which are
+// applied on the sending side
+struct NetLink {
+    NetSocket socket;
+    bool open;
+    int delayMs;
+    int jitterMs;
+    int lossPercent;
+    Rng rng;                // loss and jitter rolls, never the game's streams
+    NetPacket pending[NET_MAX_PENDING];
+    int pendingCount;
+    long long sent;
+    long long dropped;
+    long long received;
+};
+
+struct RollbackStats {
+    long long ticks;            // ticks simulated the first time
+    long long rollbacks;
+    long long resimulatedTicks;
+    int maxDepth;
+    double resimulateMs;
+    long long stalls;           // ticks held back because the window was full
+    // Frame-level counters for the overlay (reset by the caller)
+    int frameResimulatedTicks;
+    double frameResimulateMs;
+};
+
+// Inputs live in rings indexed by tick % NET_INPUT_RING; world states in
+// a ring indexed by tick % ROLLBACK_STATES, each saved before its tick ran.
+struct RollbackSession {
+    bool active;
+    NetLink link;
+    int localIndex;                 // 0 = player, 1 = partner
+    long long frame;                // next tick to simulate
+    long long remoteConfirmed;      // remote input known for every tick up to here
+    long long remoteAcked;          // the peer has our inputs up to here
+    long long rollbackFrom;         // earliest tick run on a wrong guess, or -1
+    unsigned char localInputs[NET_INPUT_RING];
+    unsigned char remoteInputs[NET_INPUT_RING];
+    long long remoteFrame[NET_INPUT_RING];      // tick each remoteInputs slot holds, or -1
+    unsigned char predicted[NET_INPUT_RING];    // guess each tick was last run with
+    WorldState states[ROLLBACK_STATES];
+    GameEvents scratchEvents;       // re-simulated ticks' events are not replayed
+    RollbackStats stats;
+};
+
+// Everything the render thread reads from one tick: HUD values, entity
+// positions for interpolation, and the events of every tick since the
+// renderer last took a frame. Columns are sized to the pool capacities.
+struct RenderFrame {
+    GameState game;
+    Player player;
+    Player partner;
+    Boss boss;
+    int enemyCount;
+    int bulletCount;
+    int bossBulletCount;
+    vector<float> enemyX, enemyY, enemyPrevY;
+    vector<float> bulletX, bulletY, bulletPrevY;
+    vector<float> bossBulletX, bossBulletY, bossBulletPrevX, bossBulletPrevY;
+    GameEvents events;
+    int ticks;                  // ticks those events came from, at most maxTicks
+    int maxTicks;
+    vector<int> tickEvents;     // events from each of those ticks, oldest first
+    long long tickTimeNs;       // RenderClockNs() when the newest tick finished
+    bool netplay;
+    RollbackStats netStats;
+    long long netLead;          // ticks ahead of the last confirmed remote input
+    long long netDropped;
+};
+
+// Lock-free triple buffer between the simulation and render threads. The
+// simulation fills back and swaps it into middle; the renderer swaps middle
+// with front when middle is fresh. Neither side ever waits for the other.
+struct FrameExchange {
+    RenderFrame frames[3];
+    atomic<int> middle;     // slot index | RENDER_FRAME_FRESH
+    int back;               // simulation thread only
+    int front;              // render thread only
+    bool carry;             // back was never taken, so its events still count
+};
+
+// Shared between the render thread (window, input, audio, drawing) and the
+// simulation thread. Held keys are overwritten every frame; presses are
+// or'ed in until a tick takes them.
+struct SimulationLink {
+    FrameExchange exchange;
+    atomic<unsigned int> heldInput;
+    atomic<unsigned int> pressedInput;
+    atomic<bool> quit;
+};
+
+// Phases timed by the frame profiler. The tick sub-phases (move..score)
+// are nested inside PHASE_TICK, which runs on the simulation thread.
+enum ProfilePhase {
+    PHASE_FRAME,
+    PHASE_MUSIC,
+    PHASE_INPUT,
+    PHASE_TICK,
+    PHASE_MOVE,
+    PHASE_BROADPHASE,
+    PHASE_COLLISIONS,
+    PHASE_SCORE,
+    PHASE_AUDIO,
+    PHASE_PARTICLES,
+    PHASE_DRAW,
+    PHASE_PRESENT,
+    PHASE_COUNT
+};
+
+// frame is the recording thread's own counter: render frames on the render
+// thread, ticks on the simulation thread.
+struct ProfileSample {
+    long long startNs;
+    long long endNs;
+    unsigned int frame;
+    int phase;
+    int thread;
+};
+
+// One ring entry. seq is ticket + 1 once the sample for that ticket is
+// complete and 0 while it is being written, so a reader can tell a torn or
+// overwritten slot from a good one (a per-slot seqlock).
+struct ProfileSlot {
+    atomic<unsigned int> seq;
+    atomic<long long> startNs;
+    atomic<long long> endNs;
+    atomic<unsigned int> frame;
+    atomic<int> phase;
+    atomic<int> thread;
+};
+
+// Ring buffer of timing samples. Writers claim a ticket with one atomic add,
+// so recording never takes a lock; the oldest samples are overwritten.
+struct Profiler {
+    ProfileSlot slots[PROFILE_RING_SIZE];
+    atomic<unsigned int> head;
+    atomic<unsigned int> frames[PROFILE_THREADS];   // each advanced by its own thread
+    bool enabled;
+    chrono::steady_clock::time_point epoch;
+};
+
+struct PhaseStats {
+    double minMs;
+    double avgMs;
+    double p99Ms;
+};
+
+#if defined(SPACE_BENCHMARK)
+// Microbenchmarks: one case is set up (untimed), then run (timed) per rep
+struct BenchContext {
+    GameWorld world;
+    SpatialGrid enemyGrid;
+    GameEvents events;
+    ParticleSystem particles;
+    int entities;
+    Rng rng;                // scatters benchmark entities
+    vector<unsigned char> snapshot;
+    int snapshotSize;
+};
+
+struct MicroBenchmark {
+    const char* name;
+    void (*setup)(BenchContext& ctx, int entities);
+    void (*run)(BenchContext& ctx);
+};
+#endif
+
 // -----------------------------------------------------------------------------
 // FUNCTION PROTOTYPES (ALL PARAMETERS)
 // -----------------------------------------------------------------------------
 
-// Window / resources
-void InitWindowAndResources(GameResources& res);
-void UnloadResourcesAndCloseWindow(GameResources& res);
+// Window / resources
+void InitWindowAndResources(GameResources& res, const GameConfig& config);
+void UnloadResourcesAndCloseWindow(GameResources& res);
+
+// Background asset loading
+int AddAssetJob(AssetLoader& loader, void (*run)(AssetLoader& loader, int arg), int arg);
+void AddAssetDependency(AssetLoader& loader, int job, int dependsOn);
+void DecodeSpriteJob(AssetLoader& loader, int sprite);
+void ComposeAtlasJob(AssetLoader& loader, int unused);
+void DecodeWaveJob(AssetLoader& loader, int sound);
+void RunAssetWorker(AssetLoader* loader);
+void StartAssetLoading(AssetLoader& loader);
+void DrawLoadingScreen(const AssetLoader& loader);
+void WaitForAssetLoading(AssetLoader& loader);
+
+// Asset packs + resource cache
+void BuildAssetPack(AssetLoader& loader, AssetPack& pack);
+bool WriteAssetPack(const char* path);
+bool MapAssetPack(AssetPack& pack, const char* path);
+void UnmapAssetPack(AssetPack& pack);
+bool IndexAssetPack(ResourceCache& cache);
+void AcquireAsset(ResourceCache& cache, AssetId id);
+void ReleaseAsset(ResourceCache& cache, AssetId id);
+
+// Sound voices
+void InitVoicePool(VoicePool& pool, int limit);
+void PlayVoice(VoicePool& pool, ResourceCache& cache, AssetId sound, int priority);
+int CountPlayingVoices(const VoicePool& pool);
+void ReleaseVoicePool(VoicePool& pool, ResourceCache& cache);
+
+// Sprite atlas + batcher
+int PackSpriteAtlas(SpriteAtlas& atlas, const int sizes[][2], int count);
+Image DecodeSprite(const char* file, int width, int height, bool& loaded);
+Image ComposeSpriteAtlas(const SpriteAtlas& atlas, Image sprites[], int count, int height);
+void InitSpriteBatch(SpriteBatch& batch, int capacity);
+void BeginSpriteBatch(SpriteBatch& batch);
+void SubmitSprite(SpriteBatch& batch, SpriteLayer layer, SpriteId sprite, Rectangle dest, Color tint);
+void FlushSpriteBatch(SpriteBatch& batch, const SpriteAtlas& atlas);
+
+// Cached render layers
+void InitRenderCache(RenderCache& cache);
+void UnloadRenderCache(RenderCache& cache);
+void BlitRenderTexture(const RenderTexture2D& target, float x, float y);
+void DrawCachedText(RenderCache& cache, HudText id, int value, const char* format, int x, int y, Color color);
+void DrawCachedScreen(RenderCache& cache, const GameState& game);
+
+// Command line
+void ParseCommandLine(int argc, char* argv[], GameConfig& config);
+int ClampCapacity(int value);
+
+// Random numbers
+void RngSeed(Rng& rng, unsigned long long seed, unsigned long long stream);
+unsigned int RngNext(Rng& rng);
+int RngRange(Rng& rng, int min, int max);
+float RngFloat(Rng& rng);
+void SeedGameRng(GameState& game, unsigned int seed);
+unsigned int NewRandomSeed();
+
+// Game initialization
+void InitPlayer(Player& player);
+void InitPartner(Player& partner);
+void InitBullets(BulletPool& bullets);
+void InitBoss(Boss& boss, int health);
+void InitBossBullets(BossBulletPool& bossBullets);
+bool WaveSlotIsFree(const int cells[], int cols, int rows, int cx, int cy,
+    const float xs[], const float ys[], int x, int y, int w, int h);
+int GenerateWaveLayout(Rng& rng, int count, int minX, int maxX, int minY, int maxY, int w, int h,
+    int cells[], int active[], float outX[], float outY[]);
+void InitEnemiesForLevel(GameState& game, EnemyPool& enemies);
+void InitGame(GameState& game, Player& player, EnemyPool& enemies, BulletPool& bullets,
+    Boss& boss, BossBulletPool& bossBullets, Arena& arena, unsigned int seed, const BalanceParams& balance);
+
+// Entity pools
+void MoveSlot(EnemyColumns& cols, int dst, int src);
+void MoveSlot(BulletColumns& cols, int dst, int src);
+void MoveSlot(BossBulletColumns& cols, int dst, int src);
+template <class Columns> void PoolInit(Pool<Columns>& pool);
+template <class Columns> void PoolClear(Pool<Columns>& pool);
+template <class Columns> int PoolAcquire(Pool<Columns>& pool);
+template <class Columns> void PoolReleaseAt(Pool<Columns>& pool, int index);
+template <class Columns> int PoolCompact(Pool<Columns>& pool, const unsigned char keep[]);
+int RemoveDeadEnemies(EnemyPool& enemies);
+bool SpawnBullet(BulletPool& bullets, float x, float y);
+int CullBulletsOutsideY(BulletPool& bullets, float minY, float maxY);
+bool SpawnBossBullet(BossBulletPool& bossBullets, float x, float y, float vx, float vy);
+
+// Level arena
+void InitArena(Arena& arena, size_t bytes);
+void FreeArena(Arena& arena);
+void* ArenaAlloc(Arena& arena, size_t bytes);
+template <typename T> T* ArenaArray(Arena& arena, int count);
+void ArenaReset(Arena& arena);
+void CarveColumns(Arena& arena, EnemyColumns& cols, int capacity);
+void CarveColumns(Arena& arena, BulletColumns& cols, int capacity);
+void CarveColumns(Arena& arena, BossBulletColumns& cols, int capacity);
+template <class Columns> void CarvePool(Arena& arena, Pool<Columns>& pool, int capacity);
+void CarveLevel(Arena& arena, EnemyPool& enemies, BulletPool& bullets, BossBulletPool& bossBullets,
+    const EntityCapacities& capacities);
+size_t LevelArenaBytes(const EntityCapacities& capacities);
+void InitLevelArena(Arena& arena, EnemyPool& enemies, BulletPool& bullets, BossBulletPool& bossBullets,
+    const EntityCapacities& capacities);
+void ResetLevelArena(Arena& arena, EnemyPool& enemies, BulletPool& bullets, BossBulletPool& bossBullets);
+
+// SIMD kernels
+void IntegrateAndWrapY(float y[], float prevY[], const float speed[], int count, float dt, float wrapBelow, float wrapTo);
+void IntegrateY(float y[], float prevY[], int count, float dy);
+int MarkInsideY(const float y[], int count, float minY, float maxY, unsigned char keep[]);
+int IntegrateAndMarkInside(float x[], float y[], float prevX[], float prevY[], const float vx[], const float vy[],
+    int count, float dt, float minX, float maxX, float minY, float maxY, unsigned char keep[]);
+int IntegrateParticles(float x[], float y[], float prevX[], float prevY[], float vx[], float vy[], float life[],
+    int count, float dt, float gravity, float damping, unsigned char keep[]);
+
+// Particles
+void InitParticles(ParticleSystem& ps, unsigned int seed);
+void EmitParticles(ParticleSystem& ps, float x, float y, int count, float angle, float spread,
+    float minSpeed, float maxSpeed, float life, float size, Color color);
+void SpawnEventParticles(ParticleSystem& ps, const GameEvents& events, const Player& player);
+void MoveParticle(ParticleSystem& ps, int dst, int src);
+void UpdateParticles(ParticleSystem& ps, float dt);
+void DrawParticles(const ParticleSystem& ps, const SpriteAtlas& atlas, float alpha);
+
+// Broadphase (uniform grid)
+void InitSpatialGrid(SpatialGrid& grid, float originX, float originY, float width, float height, float cellSize);
+void InitBroadphase(Broadphase& broadphase, const EntityCapacities& capacities);
+int GridCellCoord(float value, float origin, float cellSize, int cells);
+void BuildSpatialGrid(SpatialGrid& grid, const float xs[], const float ys[], int count);
+int QuerySpatialGrid(const SpatialGrid& grid, float x, float y, float w, float h, int out[], int maxOut);
+float MaxStep(const float positions[], const float previous[], int count);
+int QuerySweptBox(const SpatialGrid& grid, float x, float y, float w, float h, float dx, float dy,
+    int out[], int maxOut);
+void RunBroadphaseBenchmark();
+
+// Narrowphase (swept AABB tests)
+float SweptHitTime(float ax, float ay, float aw, float ah, float adx, float ady,
+    float bx, float by, float bw, float bh, float bdx, float bdy);
+void SweptHitTimeBatch(float ax, float ay, float aw, float ah, float adx, float ady,
+    const float bx[], const float by[], const float bdx[], const float bdy[], float bw, float bh, int count, float times[]);
+int FirstHitInCandidates(float ax, float ay, float aw, float ah, float adx, float ady,
+    const float xs[], const float ys[], const float prevXs[], const float prevYs[], float bw, float bh,
+    const int candidates[], int found, float& hitTime);
+
+// Simulation step (no window, input or audio access)
+void PushEvent(GameEvents& events, GameEventType type, float x, float y);
+void StepSimulation(GameWorld& world, const InputState& input, float dt, GameEvents& events);
+void StepSimulation(GameWorld& world, const InputState& input, const InputState& partnerInput, float dt,
+    GameEvents& events);
+
+// Frame profiler
+void InitProfiler(bool enabled);
+long long ProfileBegin();
+long long ProfileLap(ProfilePhase phase, long long start);
+void ProfileEnd(ProfilePhase phase, long long start);
+void ProfileNextFrame();
+bool ReadProfileSample(unsigned int ticket, ProfileSample& sample);
+void ComputePhaseStats(PhaseStats stats[PHASE_COUNT]);
+void DrawProfilerOverlay();
+bool WriteChromeTrace(const char* path);
+
+// Frontend: keyboard, audio and main game loop
+void PollInput(InputState& input);
+void ConsumePressedInput(InputState& input);
+void SubmitInput(SimulationLink& link, InputState& input);
+void PlayGameEvents(const GameEvents& events, GameResources& res, VoicePool& voices);
+void RunGameLoop(GameWorld& world, GameResources& res, const GameConfig& config, ReplaySession& replay,
+    RollbackSession& netplay);
+
+// Simulation thread and render frames
+long long RenderClockNs();
+void InitRenderFrame(RenderFrame& frame, const GameWorld& world, int maxTicks);
+void DropOldestRenderTick(RenderFrame& frame);
+void CaptureRenderFrame(RenderFrame& frame, const GameWorld& world, const RollbackSession& netplay,
+    const GameEvents& events, bool carry, bool ticked, long long tickTimeNs);
+void InitFrameExchange(FrameExchange& exchange, const GameWorld& world, const RollbackSession& netplay,
+    int maxTicks);
+void PublishRenderFrame(FrameExchange& exchange);
+bool AcquireRenderFrame(FrameExchange& exchange);
+void RunSimulation(GameWorld& world, const GameConfig& config, ReplaySession& replay, RollbackSession& netplay,
+    SimulationLink& link);
+void DrawRenderStats(const SpriteBatch& batch, const VoicePool& voices, const ParticleSystem& particles,
+    const RenderCache& cache);
+
+// Input replays
+unsigned int BuildHash();
+unsigned char PackInput(const InputState& input);
+void UnpackInput(unsigned char bits, InputState& input);
+void PutVarint(ofstream& file, unsigned long long value);
+bool GetVarint(ifstream& file, unsigned long long& value);
+bool OpenReplayWriter(ReplayWriter& writer, const char* path, unsigned int seed, int tickRate,
+    const EntityCapacities& capacities);
+void FlushReplayRun(ReplayWriter& writer);
+void RecordReplayTick(ReplayWriter& writer, const InputState& input);
+void RecordReplaySnapshot(ReplayWriter& writer, const GameWorld& world);
+void CloseReplayWriter(ReplayWriter& writer);
+bool OpenReplayReader(ReplayReader& reader, const char* path);
+bool ReadReplayRun(ReplayReader& reader, GameWorld* world);
+void ReplayBeforeTick(ReplaySession& replay, InputState& input);
+void ReplayAfterTick(ReplaySession& replay, GameWorld& world, const GameEvents& events);
+
+// Netplay (rollback over UDP)
+long long NetClockMs();
+bool ParseNetAddress(const char* text, sockaddr_in& address);
+bool OpenNetLink(NetLink& link, int localPort, const char* peer, const GameConfig& config);
+void CloseNetLink(NetLink& link);
+void SendNetPacket(NetLink& link, const unsigned char* data, int size);
+void FlushNetLink(NetLink& link);
+int ReceiveNetPacket(NetLink& link, unsigned char* out, int capacity);
+size_t WorldStateBytes(const GameWorld& world);
+template <typename T> void SaveColumn(unsigned char*& p, const T* column, int count);
+template <typename T> void LoadColumn(const unsigned char*& p, T* column, int count);
+void SaveWorldState(WorldState& state, const GameWorld& world);
+void LoadWorldState(GameWorld& world, const WorldState& state);
+bool ConnectNetplay(RollbackSession& session, GameConfig& config, unsigned int& seed);
+void InitRollback(RollbackSession& session, const GameWorld& world, int localIndex);
+unsigned char RemoteInputForTick(RollbackSession& session, long long tick);
+void ReceiveRemoteInput(RollbackSession& session, long long tick, unsigned char bits);
+void PollNetplay(RollbackSession& session);
+void SendNetplayInputs(RollbackSession& session);
+void SimulateNetTick(RollbackSession& session, GameWorld& world, long long tick, float dt, GameEvents& events);
+void Resimulate(RollbackSession& session, GameWorld& world, float dt);
+bool AdvanceRollback(RollbackSession& session, GameWorld& world, const InputState& localInput, float dt,
+    GameEvents& events);
+void DrawNetplayStats(const RollbackStats& stats, long long lead, long long dropped);
+void PrintNetplayStats(const RollbackSession& session);
+void PartnerBotInput(const GameWorld& world, long long tick, float dt, Rng& rng, InputState& input);
+void RunNetplayHeadless(GameWorld& world, const GameConfig& config, RollbackSession& netplay);
+
+// Headless runner
+bool BotHandleMenus(const GameWorld& world, InputState& input);
+void HeadlessBotInput(const GameWorld& world, long long tick, float dt, Rng& rng, InputState& input);
+void DodgerBotInput(const GameWorld& world, long long tick, float dt, Rng& rng, InputState& input);
+void RandomBotInput(const GameWorld& world, long long tick, float dt, Rng& rng, InputState& input);
+void RunHeadless(GameWorld& world, const GameConfig& config, ReplaySession& replay);
+
+// Balance sweeps
+BalanceParams DefaultBalance();
+bool SetBalanceParam(BalanceParams& balance, const char* name, float value);
+bool ParseSweepAxis(const char* spec, SweepAxis& axis);
+GameOutcome PlayBalanceGame(GameWorld& world, const BalanceParams& balance, BotPolicyFn policy,
+    unsigned int seed, float dt, long long maxTicks);
+void RunBalanceSweepWorker(BalanceSweep* sweep);
+void RunBalanceSweep(const GameConfig& config);
+
+// Screens: Start / Game Over / Win
+void DrawStartScreen(const GameState& game);
+void HandleStartScreenInput(GameState& game, Player& player, EnemyPool& enemies, BulletPool& bullets,
+    Boss& boss, BossBulletPool& bossBullets, Arena& arena, const InputState& input, GameEvents& events);
+void DrawGameOverScreen(const GameState& game);
+void HandleGameOverInput(GameState& game, Player& player, EnemyPool& enemies, BulletPool& bullets,
+    Boss& boss, BossBulletPool& bossBullets, Arena& arena, const InputState& input, GameEvents& events);
+void DrawWinScreen(const GameState& game);
+void HandleWinScreenInput(GameState& game, Player& player, EnemyPool& enemies, BulletPool& bullets,
+    Boss& boss, BossBulletPool& bossBullets, Arena& arena, const InputState& input, GameEvents& events);
+
+// Game update & drawing (PLAYING/BOSS state)
+void UpdateGame(GameState& game, Player& player, Player& partner, EnemyPool& enemies, BulletPool& bullets,
+    Boss& boss, BossBulletPool& bossBullets, Arena& arena, Broadphase& broadphase, const InputState& input,
+    const InputState& partnerInput, float dt, GameEvents& events);
+void DrawGame(const RenderFrame& frame, const ParticleSystem& particles, float alpha,
+    const GameResources& res, SpriteBatch& batch, RenderCache& cache);
+
+// Player movement + shooting
+void UpdatePlayer(Player& player, const InputState& input, float dt);
+void HandlePlayerShooting(const Player& player, BulletPool& bullets, const InputState& input, GameEvents& events);
+
+// Bullets & Enemies & Boss
+void UpdateBullets(BulletPool& bullets, float dt);
+void UpdateEnemies(EnemyPool& enemies, float dt);
+void UpdateBoss(Boss& boss, float dt);
+void ResetBossPattern(Boss& boss);
+void UpdateBossPhase(Boss& boss, int maxHealth);
+void FireBossBullets(BossBulletPool& bossBullets, float x, float y, int count, float first, float step, float speed);
+void RunBossPattern(Boss& boss, BossBulletPool& bossBullets, const Player& player, float dt, GameEvents& events);
+void HandleBossShooting(Boss& boss, BossBulletPool& bossBullets, const Player& player, int maxHealth, float dt,
+    GameEvents& events);
+void UpdateBossBullets(BossBulletPool& bossBullets, float dt);
+
+// Collisions & lives
+void CheckBulletEnemyCollisions(BulletPool& bullets, EnemyPool& enemies, const SpatialGrid& enemyGrid, GameEvents& events);
+bool CheckEnemyPlayerCollisions(const EnemyPool& enemies, const SpatialGrid& enemyGrid, const Player& player);
+void CheckBulletBossCollisions(BulletPool& bullets, Boss& boss, GameEvents& events);
+bool CheckBossPlayerCollision(const Boss& boss, const Player& player);
+bool CheckBossBulletPlayerCollisions(BossBulletPool& bossBullets, const SpatialGrid& bossBulletGrid, const Player& player);
+bool HandlePlayerHit(GameState& game, Player& player, Player& partner, EnemyPool& enemies, BulletPool& bullets,
+    Boss& boss, BossBulletPool& bossBullets);
+void ApplyGameEvents(GameState& game, Player& player, Player& partner, EnemyPool& enemies, BulletPool& bullets,
+    Boss& boss, BossBulletPool& bossBullets, GameEvents& events);
+
+// HUD, scoring, level progression
+void DrawHUD(RenderCache& cache, const GameState& game, const Player& player, const Boss& boss);
+void UpdateScoreAndLevel(GameState& game, Player& player, EnemyPool& enemies, BulletPool& bullets,
+    Boss& boss, BossBulletPool& bossBullets, Arena& arena);
+void ResetLevel(GameState& game, Player& player, EnemyPool& enemies, BulletPool& bullets,
+    Boss& boss, BossBulletPool& bossBullets, Arena& arena);
+void ResetGameToLevel1(GameState& game, Player& player, EnemyPool& enemies, BulletPool& bullets,
+    Boss& boss, BossBulletPool& bossBullets, Arena& arena);
+bool AreAllEnemiesDestroyed(const EnemyPool& enemies);
+
+// Save/Load (binary snapshots, legacy text saves still load)
+int SnapshotMaxBytes(const EnemyPool& enemies, const BulletPool& bullets, const BossBulletPool& bossBullets);
+unsigned int SnapshotChecksum(const unsigned char* data, int size);
+void PutSnapshotInt(unsigned char*& p, int value);
+void PutSnapshotFloats(unsigned char*& p, const float values[], int count);
+void PutSnapshotInts(unsigned char*& p, const int values[], int count);
+int GetSnapshotInt(const unsigned char*& p);
+void GetSnapshotFloats(const unsigned char*& p, float values[], int count);
+void GetSnapshotInts(const unsigned char*& p, int values[], int count);
+int SerializeSnapshot(const GameState& game, const Player& player, const EnemyPool& enemies, const BulletPool& bullets,
+    const Boss& boss, const BossBulletPool& bossBullets, unsigned char* out, int capacity);
+bool DeserializeSnapshot(const unsigned char* data, int size, GameState& game, Player& player, EnemyPool& enemies,
+    BulletPool& bullets, Boss& boss, BossBulletPool& bossBullets);
+void SaveGame(const GameState& game, const Player& player, const EnemyPool& enemies, const BulletPool& bullets,
+    const Boss& boss, const BossBulletPool& bossBullets);
+bool LoadGame(GameState& game, Player& player, EnemyPool& enemies, BulletPool& bullets,
+    Boss& boss, BossBulletPool& bossBullets);
+bool LoadLegacyGame(GameState& game, Player& player, Boss& boss);
+
+#if defined(SPACE_BENCHMARK)
+// Microbenchmarks (Benchmark build only)
+unsigned long long ReadCycleCounter();
+void BenchSpawnEnemies(BenchContext& ctx, int count, float side);
+void BenchSpawnBullets(BenchContext& ctx, int count, float side, float maxY);
+void SetupUpdateEnemies(BenchContext& ctx, int entities);
+void RunUpdateEnemies(BenchContext& ctx);
+void SetupUpdateBullets(BenchContext& ctx, int entities);
+void RunUpdateBullets(BenchContext& ctx);
+void SetupBulletEnemyCollisions(BenchContext& ctx, int entities);
+void RunBuildEnemyGrid(BenchContext& ctx);
+void RunBulletEnemyCollisions(BenchContext& ctx);
+void SetupInitEnemiesForLevel(BenchContext& ctx, int entities);
+void RunInitEnemiesForLevel(BenchContext& ctx);
+void SetupScoreSteady(BenchContext& ctx, int entities);
+void SetupScoreWaveCleared(BenchContext& ctx, int entities);
+void RunUpdateScoreAndLevel(BenchContext& ctx);
+void RunSerializeSnapshot(BenchContext& ctx);
+void SetupSnapshot(BenchContext& ctx, int entities);
+void RunDeserializeSnapshot(BenchContext& ctx);
+void SetupUpdateParticles(BenchContext& ctx, int entities);
+void RunUpdateParticles(BenchContext& ctx);
+void SetupUpdateBossBullets(BenchContext& ctx, int entities);
+void RunUpdateBossBullets(BenchContext& ctx);
+void RunMicrobenchmarks();
+#endif
+
+
+// ---------------------------------------------------------
+// MAIN FUNCTION 
+// ---------------------------------------------------------
+int main(int argc, char* argv[])
+{
+#if defined(SPACE_BENCHMARK)
+    RunMicrobenchmarks();
+    return 0;
+#endif
+
+    GameConfig config;
+    ParseCommandLine(argc, argv, config);
+
+    if (config.benchBroadphase) {
+        RunBroadphaseBenchmark();
+        return 0;
+    }
+
+    if (config.sweepPath != NULL) {
+        RunBalanceSweep(config);
+        return 0;
+    }
+
+    if (config.packPath != NULL) {
+        return WriteAssetPack(config.packPath) ? 0 : 1;
+    }
+
+    // Headless runs only pay for timing when a trace was asked for
+    InitProfiler(!config.headless || config.tracePath != NULL);
+
+    // A replay only reproduces if the game starts from the seed it recorded
+    static ReplaySession replay;
+    unsigned int seed = config.seeded ? config.seed : NewRandomSeed();
+
+    // Netplay takes seed, tick rate and capacities from player 1, and
+    // replays would only hold one side's input
+    static RollbackSession netplay;
+    if (config.netPlayer != 0) {
+        if (config.playPath != NULL || config.recordPath != NULL) {
+            cout << "replays are not available in netplay\n";
+            config.playPath = NULL;
+            config.recordPath = NULL;
+        }
+        if (!ConnectNetplay(netplay, config, seed)) {
+            return 1;
+        }
+    }
+    if (config.playPath != NULL) {
+        if (!OpenReplayReader(replay.reader, config.playPath)) {
+            cout << "could not open replay " << config.playPath << '\n';
+            return 1;
+        }
+        seed = replay.reader.seed;
+        config.tickRate = replay.reader.tickRate;
+        config.capacities = replay.reader.capacities;
+    }
+    if (config.recordPath != NULL) {
+        if (!OpenReplayWriter(replay.writer, config.recordPath, seed, config.tickRate, config.capacities)) {
+            cout << "could not write replay " << config.recordPath << '\n';
+        }
+    }
+
+    static GameWorld world;
+    InitLevelArena(world.arena, world.enemies, world.bullets, world.bossBullets, config.capacities);
+    InitGame(world.game, world.player, world.enemies, world.bullets, world.boss, world.bossBullets, world.arena,
+        seed, DefaultBalance());
+    InitBroadphase(world.broadphase, config.capacities);
+    if (config.netPlayer != 0) {
+        world.coop = true;
+        InitPartner(world.partner);
+        InitRollback(netplay, world, config.netPlayer - 1);
+    }
+
+    if (config.headless) {
+        if (netplay.active) {
+            RunNetplayHeadless(world, config, netplay);
+            CloseNetLink(netplay.link);
+            return 0;
+        }
+        RunHeadless(world, config, replay);
+        CloseReplayWriter(replay.writer);
+        return 0;
+    }
+
+    GameResources resources = { 0 };
+    InitWindowAndResources(resources, config);
+    PlayMusicStream(resources.gameTheme);
+    SetMusicVolume(resources.gameTheme, 0.2f);
+
+    RunGameLoop(world, resources, config, replay, netplay);
+    CloseReplayWriter(replay.writer);
+    if (netplay.active) {
+        PrintNetplayStats(netplay);
+        CloseNetLink(netplay.link);
+    }
+
+    UnloadResourcesAndCloseWindow(resources);
+    return 0;
+}
+
+// ---------------------------------------------------------
+// Window / resources
+// ---------------------------------------------------------
+// Opens the window straight away, then maps the prebuilt asset pack. With no
+// usable pack the assets decode in the background behind a loading screen
+// into an in-memory pack instead. Prints the cold-start timings.
+void InitWindowAndResources(GameResources& res, const GameConfig& config)
+{
+    auto start = chrono::steady_clock::now();
+
+    if (config.targetFps <= 0) {
+        SetConfigFlags(FLAG_VSYNC_HINT);
+    }
+    InitWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "Space Shooter - PF Project");
+    InitAudioDevice();
+
+    if (config.targetFps > 0) {
+        SetTargetFPS(config.targetFps);
+    }
+    SetExitKey(0);
+    double windowMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+    ResourceCache& cache = res.cache;
+    bool fromPack = MapAssetPack(cache.pack, ASSET_PACK_FILE) && IndexAssetPack(cache);
+    if (!fromPack) {
+        UnmapAssetPack(cache.pack);
+
+        static AssetLoader loader;
+        StartAssetLoading(loader);
+
+        // At least one frame, so the window never sits blank
+        do {
+            BeginDrawing();
+            DrawLoadingScreen(loader);
+            EndDrawing();
+        } while (loader.finished < loader.jobCount);
+
+        WaitForAssetLoading(loader);
+        BuildAssetPack(loader, cache.pack);
+        IndexAssetPack(cache);
+    }
+
+    for (int id = 0; id < ASSET_COUNT; id++) {
+        AcquireAsset(cache, (AssetId)id);
+    }
+    res.atlas = cache.atlas;
+    res.gameTheme = LoadMusicStream("theme.mp3");
+
+    double readyMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    cout << "startup: window " << windowMs << " ms, assets ready " << readyMs << " ms ("
+        << (fromPack ? ASSET_PACK_FILE : "decoded") << ")\n";
+}
+
+void UnloadResourcesAndCloseWindow(GameResources& res)
+{
+    for (int id = 0; id < ASSET_COUNT; id++) {
+        ReleaseAsset(res.cache, (AssetId)id);
+    }
+    UnmapAssetPack(res.cache.pack);
+    UnloadMusicStream(res.gameTheme);
+
+    CloseAudioDevice();
+    CloseWindow();
+}
+
+// ---------------------------------------------------------
+// Background asset loading
+// ---------------------------------------------------------
+int AddAssetJob(AssetLoader& loader, void (*run)(AssetLoader& loader, int arg), int arg)
+{
+    AssetJob& job = loader.jobs[loader.jobCount];
+    job.run = run;
+    job.arg = arg;
+    job.pendingDeps = 0;
+    job.dependentCount = 0;
+    return loader.jobCount++;
+}
+
+void AddAssetDependency(AssetLoader& loader, int job, int dependsOn)
+{
+    AssetJob& before = loader.jobs[dependsOn];
+    before.dependents[before.dependentCount++] = job;
+    loader.jobs[job].pendingDeps++;
+}
+
+void DecodeSpriteJob(AssetLoader& loader, int sprite)
+{
+    loader.sprites[sprite] = DecodeSprite(loader.spriteFiles[sprite],
+        loader.spriteSizes[sprite][0], loader.spriteSizes[sprite][1], loader.atlas.loaded[sprite]);
+}
+
+void ComposeAtlasJob(AssetLoader& loader, int unused)
+{
+    loader.atlasImage = ComposeSpriteAtlas(loader.atlas, loader.sprites, SPRITE_COUNT, loader.atlasHeight);
+}
+
+void DecodeWaveJob(AssetLoader& loader, int sound)
+{
+    loader.waves[sound] = LoadWave(loader.soundFiles[sound]);
+}
+
+// Runs ready jobs until every job has finished. Finishing a job may make
+// its dependents ready.
+void RunAssetWorker(AssetLoader* loader)
+{
+    for (;;) {
+        int index;
+        {
+            unique_lock<mutex> guard(loader->lock);
+            while (loader->readyHead == loader->readyTail && loader->finished < loader->jobCount) {
+                loader->wake.wait(guard);
+            }
+            if (loader->readyHead == loader->readyTail) return;
+            index = loader->ready[loader->readyHead++];
+        }
+
+        AssetJob& job = loader->jobs[index];
+        job.run(*loader, job.arg);
+
+        {
+            lock_guard<mutex> guard(loader->lock);
+            for (int i = 0; i < job.dependentCount; i++) {
+                int next = job.dependents[i];
+                if (--loader->jobs[next].pendingDeps == 0) {
+                    loader->ready[loader->readyTail++] = next;
+                }
+            }
+            loader->finished++;
+        }
+        loader->wake.notify_all();
+    }
+}
+
+// Every sprite and sound decodes independently; the atlas is composed once
+// all sprites are in. Each image is scaled to the size it is drawn at.
+void StartAssetLoading(AssetLoader& loader)
+{
+    const char* const spriteFiles[SPRITE_COUNT] = {
+        "background.png", "shooter.png", "enemy.png", "bullet.png", "boss.png", NULL
+    };
+    const int spriteSizes[SPRITE_COUNT][2] = {
+        { SCREEN_WIDTH, SCREEN_HEIGHT }, { 60, 60 }, { ENEMY_WIDTH, ENEMY_HEIGHT },
+        { BULLET_WIDTH, BULLET_HEIGHT }, { BOSS_WIDTH, BOSS_HEIGHT }, { 4, 4 }
+    };
+    // Order matches the sound AssetIds
+    const char* const soundFiles[SOUND_FILE_COUNT] = {
+        "shoot.wav", "explosion.wav", "gameover.wav", "win.wav", "hit.wav"
+    };
+
+    memcpy(loader.spriteFiles, spriteFiles, sizeof(spriteFiles));
+    memcpy(loader.spriteSizes, spriteSizes, sizeof(spriteSizes));
+    memcpy(loader.soundFiles, soundFiles, sizeof(soundFiles));
+    loader.atlasHeight = PackSpriteAtlas(loader.atlas, loader.spriteSizes, SPRITE_COUNT);
+
+    loader.jobCount = 0;
+    int compose = AddAssetJob(loader, ComposeAtlasJob, 0);
+    for (int i = 0; i < SPRITE_COUNT; i++) {
+        AddAssetDependency(loader, compose, AddAssetJob(loader, DecodeSpriteJob, i));
+    }
+    for (int i = 0; i < SOUND_FILE_COUNT; i++) {
+        AddAssetJob(loader, DecodeWaveJob, i);
+    }
+
+    loader.readyHead = 0;
+    loader.readyTail = 0;
+    loader.finished = 0;
+    for (int i = 0; i < loader.jobCount; i++) {
+        if (loader.jobs[i].pendingDeps == 0) {
+            loader.ready[loader.readyTail++] = i;
+        }
+    }
+
+    int threadCount = (int)thread::hardware_concurrency();
+    if (threadCount > loader.jobCount) threadCount = loader.jobCount;
+    if (threadCount < 1) threadCount = 1;
+    for (int i = 0; i < threadCount; i++) {
+        loader.workers.push_back(thread(RunAssetWorker, &loader));
+    }
+}
+
+void DrawLoadingScreen(const AssetLoader& loader)
+{
+    ClearBackground(BLACK);
+
+    const char* title = "SPACE SHOOTER";
+    DrawText(title, SCREEN_WIDTH / 2 - MeasureText(title, 40) / 2, SCREEN_HEIGHT / 2 - 80, 40, YELLOW);
+
+    int done = loader.finished;
+    const int barWidth = 400;
+    const int barX = SCREEN_WIDTH / 2 - barWidth / 2;
+    const int barY = SCREEN_HEIGHT / 2;
+    DrawRectangleLines(barX, barY, barWidth, 20, LIGHTGRAY);
+    DrawRectangle(barX + 2, barY + 2, (barWidth - 4) * done / loader.jobCount, 16, GREEN);
+
+    const char* status = TextFormat("Loading assets... %d / %d", done, loader.jobCount);
+    DrawText(status, SCREEN_WIDTH / 2 - MeasureText(status, 20) / 2, barY + 36, 20, LIGHTGRAY);
+}
+
+// Workers exit once every job has finished
+void WaitForAssetLoading(AssetLoader& loader)
+{
+    for (thread& worker : loader.workers) {
+        worker.join();
+    }
+    loader.workers.clear();
+}
+
+// ---------------------------------------------------------
+// Asset packs + resource cache
+// ---------------------------------------------------------
+
+// Lays the decoded assets out as a pack and frees them. Header fields:
+//   magic, version, sprite count, sound count, atlas width, height,
+//   pixel format, data offset; per sprite: region (4 floats), loaded;
+//   per sound: frame count, sample rate, sample size, channels, data offset
+void BuildAssetPack(AssetLoader& loader, AssetPack& pack)
+{
+    const int headerBytes = 4 * (8 + 5 * SPRITE_COUNT + 5 * SOUND_FILE_COUNT);
+
+    // Sample the middle of the white block so filtering never reaches the edge
+    Rectangle& white = loader.atlas.regions[SPRITE_WHITE];
+    white = { white.x + 1, white.y + 1, white.width - 2, white.height - 2 };
+
+    // Convert to the mixer's sample format now rather than at every launch
+    for (int i = 0; i < SOUND_FILE_COUNT; i++) {
+        if (loader.waves[i].data != NULL) {
+            WaveFormat(&loader.waves[i], (int)loader.waves[i].sampleRate, 32, 2);
+        }
+    }
+
+    Image& atlas = loader.atlasImage;
+    int atlasBytes = atlas.width * atlas.height * 4;
+    int soundBytes[SOUND_FILE_COUNT];
+    int soundOffsets[SOUND_FILE_COUNT];
+
+    int size = (headerBytes + ASSET_PACK_ALIGN - 1) / ASSET_PACK_ALIGN * ASSET_PACK_ALIGN;
+    int atlasOffset = size;
+    size += (atlasBytes + ASSET_PACK_ALIGN - 1) / ASSET_PACK_ALIGN * ASSET_PACK_ALIGN;
+    for (int i = 0; i < SOUND_FILE_COUNT; i++) {
+        const Wave& wave = loader.waves[i];
+        soundBytes[i] = wave.data != NULL ? (int)(wave.frameCount * wave.channels * (wave.sampleSize / 8)) : 0;
+        soundOffsets[i] = size;
+        size += (soundBytes[i] + ASSET_PACK_ALIGN - 1) / ASSET_PACK_ALIGN * ASSET_PACK_ALIGN;
+    }
+
+    pack.memory.assign(size, 0);
+    unsigned char* p = pack.memory.data();
+    PutSnapshotInt(p, (int)ASSET_PACK_MAGIC);
+    PutSnapshotInt(p, (int)ASSET_PACK_VERSION);
+    PutSnapshotInt(p, SPRITE_COUNT);
+    PutSnapshotInt(p, SOUND_FILE_COUNT);
+    PutSnapshotInt(p, atlas.width);
+    PutSnapshotInt(p, atlas.height);
+    PutSnapshotInt(p, atlas.format);
+    PutSnapshotInt(p, atlasOffset);
+    for (int i = 0; i < SPRITE_COUNT; i++) {
+        PutSnapshotFloats(p, &loader.atlas.regions[i].x, 4);
+        PutSnapshotInt(p, loader.atlas.loaded[i]);
+    }
+    for (int i = 0; i < SOUND_FILE_COUNT; i++) {
+        const Wave& wave = loader.waves[i];
+        PutSnapshotInt(p, soundBytes[i] > 0 ? (int)wave.frameCount : 0);
+        PutSnapshotInt(p, (int)wave.sampleRate);
+        PutSnapshotInt(p, (int)wave.sampleSize);
+        PutSnapshotInt(p, (int)wave.channels);
+        PutSnapshotInt(p, soundOffsets[i]);
+    }
+
+    memcpy(pack.memory.data() + atlasOffset, atlas.data, atlasBytes);
+    UnloadImage(atlas);
+    for (int i = 0; i < SOUND_FILE_COUNT; i++) {
+        if (soundBytes[i] > 0) {
+            memcpy(pack.memory.data() + soundOffsets[i], loader.waves[i].data, soundBytes[i]);
+        }
+        UnloadWave(loader.waves[i]);
+    }
+
+    pack.data = pack.memory.data();
+    pack.size = size;
+    pack.mapped = false;
+}
+
+// --pack: decodes, scales and converts every asset once, offline, into the
+// file the game maps at startup
+bool WriteAssetPack(const char* path)
+{
+    static AssetLoader loader;
+    StartAssetLoading(loader);
+    WaitForAssetLoading(loader);
+
+    AssetPack pack;
+    BuildAssetPack(loader, pack);
+
+    ofstream file(path, ios::binary);
+    file.write((const char*)pack.data, pack.size);
+    if (!file) {
+        cout << "could not write " << path << '\n';
+        return false;
+    }
+
+    cout << "wrote " << path << " (" << pack.size << " bytes)\n";
+    return true;
+}
+
+bool MapAssetPack(AssetPack& pack, const char* path)
+{
+    pack.data = NULL;
+    pack.size = 0;
+    pack.mapped = false;
+
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER size;
+    HANDLE mapping = NULL;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    }
+    CloseHandle(file);
+    if (mapping == NULL) return false;
+
+    // The view keeps the mapping alive
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (view == NULL) return false;
+
+    pack.data = (const unsigned char*)view;
+    pack.size = size.QuadPart;
+#else
+    int file = open(path, O_RDONLY);
+    if (file < 0) return false;
+
+    struct stat info;
+    void* view = MAP_FAILED;
+    if (fstat(file, &info) == 0 && info.st_size > 0) {
+        view = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    }
+    close(file);
+    if (view == MAP_FAILED) return false;
+
+    pack.data = (const unsigned char*)view;
+    pack.size = info.st_size;
+#endif
+
+    pack.mapped = true;
+    return true;
+}
+
+void UnmapAssetPack(AssetPack& pack)
+{
+    if (pack.mapped) {
+#if defined(_WIN32)
+        UnmapViewOfFile(pack.data);
+#else
+        munmap((void*)pack.data, (size_t)pack.size);
+#endif
+    }
+    pack.memory.clear();
+    pack.data = NULL;
+    pack.size = 0;
+    pack.mapped = false;
+}
+
+// Checks the header and points the cache's image and wave views into the
+// pack. Only the header is read; the pixel and sample pages stay untouched
+// until an asset is first acquired.
+bool IndexAssetPack(ResourceCache& cache)
+{
+    const int headerBytes = 4 * (8 + 5 * SPRITE_COUNT + 5 * SOUND_FILE_COUNT);
+    const AssetPack& pack = cache.pack;
+    if (pack.data == NULL || pack.size < headerBytes) return false;
+
+    const unsigned char* p = pack.data;
+    if ((unsigned int)GetSnapshotInt(p) != ASSET_PACK_MAGIC) return false;
+    if ((unsigned int)GetSnapshotInt(p) != ASSET_PACK_VERSION) return false;
+    if (GetSnapshotInt(p) != SPRITE_COUNT || GetSnapshotInt(p) != SOUND_FILE_COUNT) return false;
+
+    Image& atlas = cache.atlasImage;
+    atlas.width = GetSnapshotInt(p);
+    atlas.height = GetSnapshotInt(p);
+    atlas.format = GetSnapshotInt(p);
+    atlas.mipmaps = 1;
+    long long atlasOffset = GetSnapshotInt(p);
+    if (atlas.width != ATLAS_WIDTH || atlas.height < 1 || atlas.format != PIXELFORMAT_UNCOMPRESSED_R8G8B8A8) return false;
+    if (atlasOffset < headerBytes || atlasOffset + 4LL * atlas.width * atlas.height > pack.size) return false;
+    atlas.data = (void*)(pack.data + atlasOffset);
+
+    for (int i = 0; i < SPRITE_COUNT; i++) {
+        GetSnapshotFloats(p, &cache.atlas.regions[i].x, 4);
+        cache.atlas.loaded[i] = GetSnapshotInt(p) != 0;
+    }
+
+    for (int i = 0; i < SOUND_FILE_COUNT; i++) {
+        Wave& wave = cache.waves[i];
+        int frames = GetSnapshotInt(p);
+        wave.sampleRate = (unsigned int)GetSnapshotInt(p);
+        int sampleSize = GetSnapshotInt(p);
+        int channels = GetSnapshotInt(p);
+        long long offset = GetSnapshotInt(p);
+        if (frames < 0 || (sampleSize != 8 && sampleSize != 16 && sampleSize != 32)) return false;
+        if (channels < 1 || channels > 2) return false;
+        if (offset < headerBytes || offset + (long long)frames * channels * (sampleSize / 8) > pack.size) return false;
+
+        wave.frameCount = (unsigned int)frames;
+        wave.sampleSize = (unsigned int)sampleSize;
+        wave.channels = (unsigned int)channels;
+        wave.data = frames > 0 ? (void*)(pack.data + offset) : NULL;
+    }
+
+    memset(cache.refs, 0, sizeof(cache.refs));
+    return true;
+}
+
+// Main thread only: creating the texture or sound copies straight out of
+// the pack, with no decoding
+void AcquireAsset(ResourceCache& cache, AssetId id)
+{
+    if (cache.refs[id]++ > 0) return;
+
+    if (id == ASSET_ATLAS) {
+        cache.atlas.texture = LoadTextureFromImage(cache.atlasImage);
+    }
+    else {
+        cache.sounds[id - ASSET_FIRST_SOUND] = LoadSoundFromWave(cache.waves[id - ASSET_FIRST_SOUND]);
+    }
+}
+
+void ReleaseAsset(ResourceCache& cache, AssetId id)
+{
+    if (cache.refs[id] == 0 || --cache.refs[id] > 0) return;
+
+    if (id == ASSET_ATLAS) {
+        UnloadTexture(cache.atlas.texture);
+    }
+    else {
+        UnloadSound(cache.sounds[id - ASSET_FIRST_SOUND]);
+    }
+}
+
+// ---------------------------------------------------------
+// Sound voices
+// ---------------------------------------------------------
+void InitVoicePool(VoicePool& pool, int limit)
+{
+    pool.limit = limit < 1 ? 1 : (limit > MAX_VOICES ? MAX_VOICES : limit);
+    pool.plays = 0;
+    pool.steals = 0;
+    pool.drops = 0;
+    for (int i = 0; i < MAX_VOICES; i++) {
+        pool.voices[i].sound = -1;
+    }
+}
+
+// Uses, in order: an idle voice already aliasing this sound, any idle voice
+// (re-aliased), or the least important, oldest playing voice if it matters
+// no more than the new sound. Otherwise the new sound is dropped.
+void PlayVoice(VoicePool& pool, ResourceCache& cache, AssetId sound, int priority)
+{
+    int pick = -1;
+    int idle = -1;
+    int victim = -1;
+
+    for (int i = 0; i < pool.limit; i++) {
+        const Voice& voice = pool.voices[i];
+        if (voice.sound < 0 || !IsSoundPlaying(voice.alias)) {
+            if (voice.sound == sound) {
+                pick = i;
+                break;
+            }
+            if (idle < 0) idle = i;
+            continue;
+        }
+        if (victim < 0 || voice.priority < pool.voices[victim].priority
+            || (voice.priority == pool.voices[victim].priority && voice.started < pool.voices[victim].started)) {
+            victim = i;
+        }
+    }
+
+    if (pick < 0) pick = idle;
+    if (pick < 0) {
+        if (pool.voices[victim].priority > priority) {
+            pool.drops++;
+            return;
+        }
+        StopSound(pool.voices[victim].alias);
+        pool.steals++;
+        pick = victim;
+    }
+
+    Voice& voice = pool.voices[pick];
+    if (voice.sound != sound) {
+        if (voice.sound >= 0) {
+            UnloadSoundAlias(voice.alias);
+            ReleaseAsset(cache, (AssetId)voice.sound);
+        }
+        AcquireAsset(cache, sound);
+        voice.alias = LoadSoundAlias(cache.sounds[sound - ASSET_FIRST_SOUND]);
+        voice.sound = sound;
+    }
+
+    voice.priority = priority;
+    voice.started = pool.plays++;
+    PlaySound(voice.alias);
+}
+
+int CountPlayingVoices(const VoicePool& pool)
+{
+    int playing = 0;
+    for (int i = 0; i < pool.limit; i++) {
+        if (pool.voices[i].sound >= 0 && IsSoundPlaying(pool.voices[i].alias)) playing++;
+    }
+    return playing;
+}
+
+void ReleaseVoicePool(VoicePool& pool, ResourceCache& cache)
+{
+    for (int i = 0; i < MAX_VOICES; i++) {
+        Voice& voice = pool.voices[i];
+        if (voice.sound < 0) continue;
+
+        StopSound(voice.alias);
+        UnloadSoundAlias(voice.alias);
+        ReleaseAsset(cache, (AssetId)voice.sound);
+        voice.sound = -1;
+    }
+}
+
+// ---------------------------------------------------------
+// Sprite atlas + batcher
+// ---------------------------------------------------------
+
+// Places every sprite with a shelf packer (tallest first) and returns the
+// atlas height. Images are drawn in later by ComposeSpriteAtlas.
+int PackSpriteAtlas(SpriteAtlas& atlas, const int sizes[][2], int count)
+{
+    int sorted[SPRITE_COUNT];
+    for (int i = 0; i < count; i++) {
+        int j = i;
+        while (j > 0 && sizes[sorted[j - 1]][1] < sizes[i][1]) {
+            sorted[j] = sorted[j - 1];
+            j--;
+        }
+        sorted[j] = i;
+    }
+
+    // Place shelves left to right, top to bottom
+    int penX = 0;
+    int penY = 0;
+    int shelfHeight = 0;
+    for (int k = 0; k < count; k++) {
+        int i = sorted[k];
+        int w = sizes[i][0];
+        int h = sizes[i][1];
+        if (penX + w > ATLAS_WIDTH) {
+            penX = 0;
+            penY += shelfHeight + ATLAS_PADDING;
+            shelfHeight = 0;
+        }
+        atlas.regions[i] = { (float)penX, (float)penY, (float)w, (float)h };
+        penX += w + ATLAS_PADDING;
+        if (h > shelfHeight) shelfHeight = h;
+    }
+
+    int atlasHeight = 1;
+    while (atlasHeight < penY + shelfHeight) atlasHeight *= 2;
+    return atlasHeight;
+}
+
+// Loads one image scaled to its draw size. A NULL file name or a missing
+// image gets a solid white block instead. CPU only, safe on any thread.
+Image DecodeSprite(const char* file, int width, int height, bool& loaded)
+{
+    Image sprite = { 0 };
+    if (file != NULL && FileExists(file)) {
+        sprite = LoadImage(file);
+    }
+
+    loaded = sprite.data != NULL;
+    if (loaded) {
+        ImageFormat(&sprite, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+        ImageResize(&sprite, width, height);
+    }
+    else {
+        sprite = GenImageColor(width, height, WHITE);
+    }
+    return sprite;
+}
+
+// Draws the decoded sprites into their packed regions and frees them
+Image ComposeSpriteAtlas(const SpriteAtlas& atlas, Image sprites[], int count, int height)
+{
+    Image image = GenImageColor(ATLAS_WIDTH, height, BLANK);
+    for (int i = 0; i < count; i++) {
+        Rectangle dest = atlas.regions[i];
+        Rectangle source = { 0, 0, dest.width, dest.height };
+        ImageDraw(&image, sprites[i], source, dest, WHITE);
+        UnloadImage(sprites[i]);
+    }
+    return image;
+}
+
+void InitSpriteBatch(SpriteBatch& batch, int capacity)
+{
+    batch.items.resize(capacity);
+    batch.order.resize(capacity);
+    batch.count = 0;
+}
+
+void BeginSpriteBatch(SpriteBatch& batch)
+{
+    batch.count = 0;
+    batch.drawCalls = 0;
+    batch.batchFlushes = 0;
+}
+
+void SubmitSprite(SpriteBatch& batch, SpriteLayer layer, SpriteId sprite, Rectangle dest, Color tint)
+{
+    if (batch.count >= (int)batch.items.size()) return;
+
+    SpriteCommand& cmd = batch.items[batch.count++];
+    cmd.dest = dest;
+    cmd.sprite = (unsigned char)sprite;
+    cmd.layer = (unsigned char)layer;
+    cmd.tint = tint;
+}
+
+// Sorts the submitted sprites by layer (counting sort, stable) and emits
+// each non-empty layer as one run of quads against the atlas texture.
+void FlushSpriteBatch(SpriteBatch& batch, const SpriteAtlas& atlas)
+{
+    int layerStart[LAYER_COUNT + 1] = { 0 };
+    for (int i = 0; i < batch.count; i++) {
+        layerStart[batch.items[i].layer + 1]++;
+    }
+    for (int l = 0; l < LAYER_COUNT; l++) {
+        layerStart[l + 1] += layerStart[l];
+    }
+
+    int fill[LAYER_COUNT];
+    for (int l = 0; l < LAYER_COUNT; l++) {
+        fill[l] = layerStart[l];
+    }
+    for (int i = 0; i < batch.count; i++) {
+        batch.order[fill[batch.items[i].layer]++] = i;
+    }
+
+    const float invW = 1.0f / atlas.texture.width;
+    const float invH = 1.0f / atlas.texture.height;
+
+    for (int l = 0; l < LAYER_COUNT; l++) {
+        int first = layerStart[l];
+        int quads = layerStart[l + 1] - first;
+        if (quads == 0) continue;
+
+        // rlgl flushes on its own when the vertex buffer would overflow
+        if (rlCheckRenderBatchLimit(4 * quads)) {
+            batch.batchFlushes++;
+        }
+
+        rlSetTexture(atlas.texture.id);
+        rlBegin(RL_QUADS);
+        rlNormal3f(0.0f, 0.0f, 1.0f);
+
+        for (int k = first; k < first + quads; k++) {
+            const SpriteCommand& cmd = batch.items[batch.order[k]];
+            const Rectangle& src = atlas.regions[cmd.sprite];
+            float u0 = src.x * invW;
+            float v0 = src.y * invH;
+            float u1 = (src.x + src.width) * invW;
+            float v1 = (src.y + src.height) * invH;
+            float x0 = cmd.dest.x;
+            float y0 = cmd.dest.y;
+            float x1 = cmd.dest.x + cmd.dest.width;
+            float y1 = cmd.dest.y + cmd.dest.height;
+
+            rlColor4ub(cmd.tint.r, cmd.tint.g, cmd.tint.b, cmd.tint.a);
+            rlTexCoord2f(u0, v0); rlVertex2f(x0, y0);
+            rlTexCoord2f(u0, v1); rlVertex2f(x0, y1);
+            rlTexCoord2f(u1, v1); rlVertex2f(x1, y1);
+            rlTexCoord2f(u1, v0); rlVertex2f(x1, y0);
+        }
+
+        rlEnd();
+        rlSetTexture(0);
+        batch.drawCalls++;
+    }
+
+    // Submit the whole sprite pass now rather than on the next texture switch
+    rlDrawRenderBatchActive();
+    batch.batchFlushes++;
+}
+
+// ---------------------------------------------------------
+// Cached render layers
+// ---------------------------------------------------------
+// Needs the window's GL context
+void InitRenderCache(RenderCache& cache)
+{
+    cache.screen = LoadRenderTexture(SCREEN_WIDTH, SCREEN_HEIGHT);
+    cache.screenBaked = false;
+    for (int i = 0; i < HUD_TEXT_COUNT; i++) {
+        cache.hud[i].target = LoadRenderTexture(HUD_TEXT_WIDTH, HUD_TEXT_HEIGHT);
+        cache.hud[i].baked = false;
+    }
+    cache.bakes = 0;
+}
+
+void UnloadRenderCache(RenderCache& cache)
+{
+    UnloadRenderTexture(cache.screen);
+    for (int i = 0; i < HUD_TEXT_COUNT; i++) {
+        UnloadRenderTexture(cache.hud[i].target);
+    }
+}
+
+// Render textures are stored bottom-up, hence the negative source height
+void BlitRenderTexture(const RenderTexture2D& target, float x, float y)
+{
+    Rectangle source = { 0, 0, (float)target.texture.width, -(float)target.texture.height };
+    DrawTextureRec(target.texture, source, { x, y }, WHITE);
+}
+
+// format gets value as its only argument. Text is baked onto a transparent
+// background so it can be blitted over the playfield.
+void DrawCachedText(RenderCache& cache, HudText id, int value, const char* format, int x, int y, Color color)
+{
+    CachedText& text = cache.hud[id];
+    if (!text.baked || text.value != value) {
+        BeginTextureMode(text.target);
+        ClearBackground(BLANK);
+        DrawText(TextFormat(format, value), 0, 0, HUD_FONT_SIZE, color);
+        EndTextureMode();
+        text.value = value;
+        text.baked = true;
+        cache.bakes++;
+    }
+    BlitRenderTexture(text.target, (float)x, (float)y);
+}
+
+// Start, game over and win screens. They are drawn over black, so the
+// texture is cleared to black and the blit covers the whole window.
+void DrawCachedScreen(RenderCache& cache, const GameState& game)
+{
+    if (!cache.screenBaked || cache.screenState != game.gameState || cache.screenScore != game.score
+        || cache.screenHighScore != game.highScore || cache.screenScorePerLevel != game.balance.scorePerLevel) {
+        BeginTextureMode(cache.screen);
+        ClearBackground(BLACK);
+        if (game.gameState == STATE_MENU) {
+            DrawStartScreen(game);
+        }
+        else if (game.gameState == STATE_GAME_OVER) {
+            DrawGameOverScreen(game);
+        }
+        else if (game.gameState == STATE_WIN) {
+            DrawWinScreen(game);
+        }
+        EndTextureMode();
+
+        cache.screenBaked = true;
+        cache.screenState = game.gameState;
+        cache.screenScore = game.score;
+        cache.screenHighScore = game.highScore;
+        cache.screenScorePerLevel = game.balance.scorePerLevel;
+        cache.bakes++;
+    }
+    BlitRenderTexture(cache.screen, 0, 0);
+}
+
+// ---------------------------------------------------------
+// Command line
+// ---------------------------------------------------------
+void ParseCommandLine(int argc, char* argv[], GameConfig& config)
+{
+    config.headless = false;
+    config.headlessTicks = 1000000;
+    config.benchBroadphase = false;
+    config.tickRate = DEFAULT_TICK_RATE;
+    config.maxCatchUpSteps = DEFAULT_MAX_CATCH_UP_STEPS;
+    config.targetFps = 0;
+    config.tracePath = NULL;
+    config.recordPath = NULL;
+    config.playPath = NULL;
+    config.seeded = false;
+    config.seed = 0;
+    config.sweepPath = NULL;
+    config.sweepGames = 200;
+    config.sweepThreads = 0;
+    config.packPath = NULL;
+    config.voiceLimit = DEFAULT_VOICES;
+    config.capacities.enemies = DEFAULT_MAX_ENEMIES;
+    config.capacities.bullets = DEFAULT_MAX_BULLETS;
+    config.capacities.bossBullets = DEFAULT_MAX_BOSS_BULLETS;
+    config.netPlayer = 0;
+    config.netPort = 0;
+    config.netPeer = NULL;
+    config.netDelayMs = 0;
+    config.netJitterMs = 0;
+    config.netLossPercent = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--headless") == 0) {
+            config.headless = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                config.headlessTicks = atoll(argv[++i]);
+            }
+        }
+        else if (strcmp(argv[i], "--bench-broadphase") == 0) {
+            config.benchBroadphase = true;
+        }
+        else if (strcmp(argv[i], "--tick-rate") == 0 && i + 1 < argc) {
+            config.tickRate = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--max-catch-up") == 0 && i + 1 < argc) {
+            config.maxCatchUpSteps = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) {
+            config.targetFps = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            config.tracePath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            config.recordPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--play") == 0 && i + 1 < argc) {
+            config.playPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            config.seeded = true;
+            config.seed = (unsigned int)strtoul(argv[++i], NULL, 0);
+        }
+        else if (strcmp(argv[i], "--max-enemies") == 0 && i + 1 < argc) {
+            config.capacities.enemies = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--max-bullets") == 0 && i + 1 < argc) {
+            config.capacities.bullets = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--max-boss-bullets") == 0 && i + 1 < argc) {
+            config.capacities.bossBullets = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--voices") == 0 && i + 1 < argc) {
+            config.voiceLimit = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--pack") == 0 && i + 1 < argc) {
+            config.packPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--sweep") == 0 && i + 1 < argc) {
+            config.sweepPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--sweep-games") == 0 && i + 1 < argc) {
+            config.sweepGames = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            config.sweepThreads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--net-player") == 0 && i + 1 < argc) {
+            config.netPlayer = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--net-port") == 0 && i + 1 < argc) {
+            config.netPort = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--net-peer") == 0 && i + 1 < argc) {
+            config.netPeer = argv[++i];
+        }
+        else if (strcmp(argv[i], "--net-delay") == 0 && i + 1 < argc) {
+            config.netDelayMs = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--net-jitter") == 0 && i + 1 < argc) {
+            config.netJitterMs = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--net-loss") == 0 && i + 1 < argc) {
+            config.netLossPercent = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--vary") == 0 && i + 1 < argc) {
+            SweepAxis axis;
+            if (ParseSweepAxis(argv[++i], axis)) {
+                config.sweepAxes.push_back(axis);
+            }
+            else {
+                cout << "ignoring --vary " << argv[i] << " (expected name=v1,v2,...)\n";
+            }
+        }
+    }
+
+    if (config.tickRate < 1) config.tickRate = 1;
+    if (config.sweepGames < 1) config.sweepGames = 1;
+    if (config.maxCatchUpSteps < 1) config.maxCatchUpSteps = 1;
+    config.capacities.enemies = ClampCapacity(config.capacities.enemies);
+    config.capacities.bullets = ClampCapacity(config.capacities.bullets);
+    config.capacities.bossBullets = ClampCapacity(config.capacities.bossBullets);
+    if (config.netPlayer != 0 && config.netPlayer != 2) config.netPlayer = 1;
+    if (config.netDelayMs < 0) config.netDelayMs = 0;
+    if (config.netJitterMs < 0) config.netJitterMs = 0;
+    if (config.netLossPercent < 0) config.netLossPercent = 0;
+    if (config.netLossPercent > 100) config.netLossPercent = 100;
+}
+
+int ClampCapacity(int value)
+{
+    if (value < 1) return 1;
+    if (value > MAX_ENTITY_CAPACITY) return MAX_ENTITY_CAPACITY;
+    return value;
+}
+
+// ---------------------------------------------------------
+// Random numbers
+// ---------------------------------------------------------
+void RngSeed(Rng& rng, unsigned long long seed, unsigned long long stream)
+{
+    rng.state = 0;
+    rng.inc = (stream << 1) | 1;
+    RngNext(rng);
+    rng.state += seed;
+    RngNext(rng);
+}
+
+unsigned int RngNext(Rng& rng)
+{
+    unsigned long long old = rng.state;
+    rng.state = old * 6364136223846793005ULL + rng.inc;
+    unsigned int xorshifted = (unsigned int)(((old >> 18) ^ old) >> 27);
+    unsigned int rot = (unsigned int)(old >> 59);
+    return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+}
+
+// Uniform integer in [min, max], the same contract as GetRandomValue
+int RngRange(Rng& rng, int min, int max)
+{
+    if (max < min) {
+        int t = min;
+        min = max;
+        max = t;
+    }
+    unsigned long long range = (unsigned long long)((long long)max - min) + 1;
+    return (int)(min + (long long)((RngNext(rng) * range) >> 32));
+}
+
+// Uniform float in [0, 1), from the top 24 bits
+float RngFloat(Rng& rng)
+{
+    return (RngNext(rng) >> 8) * (1.0f / 16777216.0f);
+}
+
+void SeedGameRng(GameState& game, unsigned int seed)
+{
+    game.seed = seed;
+    for (int i = 0; i < RNG_STREAM_COUNT; i++) {
+        RngSeed(game.rng[i], seed, (unsigned long long)i);
+    }
+}
+
+unsigned int NewRandomSeed()
+{
+    return (unsigned int)chrono::steady_clock::now().time_since_epoch().count();
+}
+
+// ---------------------------------------------------------
+// Game initialization
+// ---------------------------------------------------------
+void InitPlayer(Player& player)
+{
+    player.width = 60;
+    player.height = 60;
+    player.x = SCREEN_WIDTH / 2.0f - player.width / 2.0f;
+    player.y = SCREEN_HEIGHT - 60.0f;
+    player.prevX = player.x;
+    player.prevY = player.y;
+    player.speed = PLAYER_SPEED;
+    player.lives = 3;
+    player.isAlive = true;
+}
+
+// The co-op partner starts (and respawns) beside player 1
+void InitPartner(Player& partner)
+{
+    InitPlayer(partner);
+    partner.x += PARTNER_OFFSET_X;
+    partner.prevX = partner.x;
+}
+
+void InitBullets(BulletPool& bullets)
+{
+    PoolInit(bullets);
+}
+
+void InitBoss(Boss& boss, int health)
+{
+    boss.x = SCREEN_WIDTH / 2.0f - BOSS_WIDTH / 2.0f;
+    boss.y = 50.0f;
+    boss.prevX = boss.x;
+    boss.speed = BOSS_SPEED;
+    boss.health = health;
+    boss.active = false;
+    ResetBossPattern(boss);
+}
+
+void InitBossBullets(BossBulletPool& bossBullets)
+{
+    PoolInit(bossBullets);
+}
+
+// Wave layout works on a grid with one cell per enemy footprint. Two
+// enemies overlap only if their top-left corners are closer than (w, h) on
+// both axes, so a cell can hold at most one enemy and a candidate only has
+// to be checked against the 3x3 cells around it.
+bool WaveSlotIsFree(const int cells[], int cols, int rows, int cx, int cy,
+    const float xs[], const float ys[], int x, int y, int w, int h)
+{
+    for (int gy = cy - 1; gy <= cy + 1; gy++) {
+        if (gy < 0 || gy >= rows) continue;
+        for (int gx = cx - 1; gx <= cx + 1; gx++) {
+            if (gx < 0 || gx >= cols) continue;
+            int other = cells[gy * cols + gx];
+            if (other >= 0 && fabsf(xs[other] - x) < w && fabsf(ys[other] - y) < h) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Places count w x h rectangles with top-left corners in [minX, maxX] x
+// [minY, maxY] without overlap. Poisson-disk sampling (Bridson) grows the
+// wave from random seeds; if that runs dry before every enemy is placed,
+// the wave is laid out on a shuffled lattice instead, which fits whenever
+// any non-overlapping layout exists. Only when the band is too small are
+// the leftovers dropped in at random. Returns how many are overlap-free.
+// cells is scratch for the layout grid, one int per w x h cell of the band
+// (WAVE_LAYOUT_CELLS for enemy waves); active is scratch for count ints.
+int GenerateWaveLayout(Rng& rng, int count, int minX, int maxX, int minY, int maxY,
+    int w, int h, int cells[], int active[], float outX[], float outY[])
+{
+    const int CANDIDATES = 30;
+    const int SEED_TRIES = 30;
+
+    int cols = (maxX - minX) / w + 1;
+    int rows = (maxY - minY) / h + 1;
+    for (int i = 0; i < cols * rows; i++) {
+        cells[i] = -1;
+    }
+    int activeCount = 0;
+    int placed = 0;
+
+    while (placed < count) {
+        int x = 0;
+        int y = 0;
+        bool found = false;
+        int from = -1;
+
+        if (activeCount == 0) {
+            // Start a new cluster
+            for (int t = 0; t < SEED_TRIES && !found; t++) {
+                x = RngRange(rng, minX, maxX);
+                y = RngRange(rng, minY, maxY);
+                found = WaveSlotIsFree(cells, cols, rows, (x - minX) / w, (y - minY) / h, outX, outY, x, y, w, h);
+            }
+            if (!found) break;
+        }
+        else {
+            // Try candidates in the ring just outside an active enemy's footprint
+            from = RngRange(rng, 0, activeCount - 1);
+            int p = active[from];
+            for (int t = 0; t < CANDIDATES && !found; t++) {
+                x = (int)outX[p] + RngRange(rng, -2 * w, 2 * w);
+                y = (int)outY[p] + RngRange(rng, -2 * h, 2 * h);
+                if (x < minX || x > maxX || y < minY || y > maxY) continue;
+                found = WaveSlotIsFree(cells, cols, rows, (x - minX) / w, (y - minY) / h, outX, outY, x, y, w, h);
+            }
+            if (!found) {
+                active[from] = active[--activeCount];
+                continue;
+            }
+        }
+
+        outX[placed] = (float)x;
+        outY[placed] = (float)y;
+        cells[(y - minY) / h * cols + (x - minX) / w] = placed;
+        active[activeCount++] = placed;
+        placed++;
+    }
+
+    if (placed == count) return count;
+
+    // Lattice fallback: cols x rows is the most that can ever fit. The
+    // Poisson grid is done with, so its cells are reused as the slot list.
+    if (cols * rows >= count) {
+        int* slots = cells;
+        for (int i = 0; i < cols * rows; i++) {
+            slots[i] = i;
+        }
+
+        float stepX = cols > 1 ? (float)(maxX - minX) / (cols - 1) : 0.0f;
+        float stepY = rows > 1 ? (float)(maxY - minY) / (rows - 1) : 0.0f;
+        for (int i = 0; i < count; i++) {
+            int j = RngRange(rng, i, cols * rows - 1);
+            int slot = slots[j];
+            slots[j] = slots[i];
+            slots[i] = slot;
+            outX[i] = (float)(int)(minX + (slot % cols) * stepX);
+            outY[i] = (float)(int)(minY + (slot / cols) * stepY);
+        }
+        return count;
+    }
+
+    int fitted = placed;
+    for (; placed < count; placed++) {
+        outX[placed] = (float)RngRange(rng, minX, maxX);
+        outY[placed] = (float)RngRange(rng, minY, maxY);
+    }
+    return fitted;
+}
+
+void InitEnemiesForLevel(GameState& game, EnemyPool& enemies)
+{
+    int level = game.level;
+
+    int enemyCount = game.balance.enemiesBase + level * game.balance.enemiesPerLevel;
+    if (enemyCount > enemies.capacity) enemyCount = enemies.capacity;
+
+    float baseSpeed = game.balance.speedBase + level * game.balance.speedPerLevel;
+
+    // The pool is emptied first, so new enemies land at dense indices
+    // [0, enemyCount) and the layout can be written straight into the columns.
+    // Its grid query scratch holds capacity ints, so it doubles as the
+    // layout's active list.
+    PoolClear(enemies);
+    int cells[WAVE_LAYOUT_CELLS];
+    GenerateWaveLayout(game.rng[RNG_WAVE_LAYOUT], enemyCount, WAVE_MIN_X, WAVE_MAX_X, WAVE_MIN_Y, WAVE_MAX_Y,
+        ENEMY_WIDTH, ENEMY_HEIGHT, cells, enemies.found, enemies.cols.x, enemies.cols.y);
+
+    for (int i = 0; i < enemyCount; i++) {
+        PoolAcquire(enemies);
+        enemies.cols.prevY[i] = enemies.cols.y[i];
+
+        float randomOffset = (float)RngRange(game.rng[RNG_SPEED_JITTER], -3, 3) * 6.0f;
+        enemies.cols.speed[i] = baseSpeed + randomOffset;
+        if (enemies.cols.speed[i] < 30.0f) enemies.cols.speed[i] = 30.0f;
+
+        enemies.cols.health[i] = game.hitsToKill;
+    }
+}
+
+void InitGame(GameState& game, Player& player,
+    EnemyPool& enemies, BulletPool& bullets,
+    Boss& boss, BossBulletPool& bossBullets, Arena& arena, unsigned int seed, const BalanceParams& balance)
+{
+    game.score = 0;
+    game.level = 1;
+    game.highScore = 0;
+    game.hitsToKill = 1;
+    game.gameOver = false;
+    game.gameWon = false;
+    game.gameState = STATE_MENU;
+    game.bossActive = false;
+    SeedGameRng(game, seed);
+    game.balance = balance;
+
+    InitPlayer(player);
+    player.lives = 3;
+
+    ResetLevelArena(arena, enemies, bullets, bossBullets);
+    InitEnemiesForLevel(game, enemies);
+    InitBoss(boss, game.balance.bossHealth);
+}
+
+// ---------------------------------------------------------
+// Entity pools
+// ---------------------------------------------------------
+void MoveSlot(EnemyColumns& cols, int dst, int src)
+{
+    cols.x[dst] = cols.x[src];
+    cols.y[dst] = cols.y[src];
+    cols.prevY[dst] = cols.prevY[src];
+    cols.speed[dst] = cols.speed[src];
+    cols.health[dst] = cols.health[src];
+}
+
+void MoveSlot(BulletColumns& cols, int dst, int src)
+{
+    cols.x[dst] = cols.x[src];
+    cols.y[dst] = cols.y[src];
+    cols.prevY[dst] = cols.prevY[src];
+}
+
+void MoveSlot(BossBulletColumns& cols, int dst, int src)
+{
+    cols.x[dst] = cols.x[src];
+    cols.y[dst] = cols.y[src];
+    cols.prevX[dst] = cols.prevX[src];
+    cols.prevY[dst] = cols.prevY[src];
+    cols.vx[dst] = cols.vx[src];
+    cols.vy[dst] = cols.vy[src];
+}
+
+template <class Columns>
+void PoolInit(Pool<Columns>& pool)
+{
+    pool.count = 0;
+}
+
+// Releases every live object at once
+template <class Columns>
+void PoolClear(Pool<Columns>& pool)
+{
+    pool.count = 0;
+}
+
+// Returns the dense index of a new object (columns left for the caller to
+// fill), or -1 when the pool is full.
+template <class Columns>
+int PoolAcquire(Pool<Columns>& pool)
+{
+    if (pool.count == pool.capacity) return -1;
+    return pool.count++;
+}
+
+// Swaps the last object into the hole, so dense order is not kept.
+template <class Columns>
+void PoolReleaseAt(Pool<Columns>& pool, int index)
+{
+    int last = --pool.count;
+    if (index != last) {
+        MoveSlot(pool.cols, index, last);
+    }
+}
+
+// Releases every object whose keep flag is zero and keeps the survivors in
+// their original order. Returns the number released.
+template <class Columns>
+int PoolCompact(Pool<Columns>& pool, const unsigned char keep[])
+{
+    int count = pool.count;
+    int write = 0;
+
+    for (int i = 0; i < count; i++) {
+        if (!keep[i]) continue;
+        if (write != i) {
+            MoveSlot(pool.cols, write, i);
+        }
+        write++;
+    }
+
+    pool.count = write;
+    return count - write;
+}
+
+// Compacts away enemies whose health dropped to zero during a collision
+// pass. Collision passes only mark kills so the grid's indices stay valid.
+int RemoveDeadEnemies(EnemyPool& enemies)
+{
+    unsigned char* keep = enemies.keep;
+    int dead = 0;
+
+    for (int i = 0; i < enemies.count; i++) {
+        keep[i] = enemies.cols.health[i] > 0;
+        dead += !keep[i];
+    }
+
+    return dead > 0 ? PoolCompact(enemies, keep) : 0;
+}
+
+bool SpawnBullet(BulletPool& bullets, float x, float y)
+{
+    int i = PoolAcquire(bullets);
+    if (i < 0) return false;
+
+    bullets.cols.x[i] = x;
+    bullets.cols.y[i] = y;
+    bullets.cols.prevY[i] = y;
+    return true;
+}
+
+// Drops every bullet whose y is outside [minY, maxY], keeping the rest in
+// order. Returns the number removed.
+int CullBulletsOutsideY(BulletPool& bullets, float minY, float maxY)
+{
+    int dropped = MarkInsideY(bullets.cols.y, bullets.count, minY, maxY, bullets.keep);
+
+    return dropped > 0 ? PoolCompact(bullets, bullets.keep) : 0;
+}
+
+bool SpawnBossBullet(BossBulletPool& bossBullets, float x, float y, float vx, float vy)
+{
+    int i = PoolAcquire(bossBullets);
+    if (i < 0) return false;
+
+    bossBullets.cols.x[i] = x;
+    bossBullets.cols.y[i] = y;
+    bossBullets.cols.prevX[i] = x;
+    bossBullets.cols.prevY[i] = y;
+    bossBullets.cols.vx[i] = vx;
+    bossBullets.cols.vy[i] = vy;
+    return true;
+}
+
+// ---------------------------------------------------------
+// Level arena
+// ---------------------------------------------------------
+void InitArena(Arena& arena, size_t bytes)
+{
+    arena.memory = new unsigned char[bytes + ARENA_ALIGN];
+    arena.base = arena.memory + (ARENA_ALIGN - (uintptr_t)arena.memory % ARENA_ALIGN) % ARENA_ALIGN;
+    arena.capacity = bytes;
+    arena.used = 0;
+}
+
+void FreeArena(Arena& arena)
+{
+    delete[] arena.memory;
+    arena.memory = NULL;
+    arena.base = NULL;
+    arena.capacity = 0;
+    arena.used = 0;
+}
+
+// Returns an ARENA_ALIGN-aligned block, or NULL when the arena is full. An
+// arena without memory only measures: it counts what a carve would take.
+void* ArenaAlloc(Arena& arena, size_t bytes)
+{
+    size_t offset = (arena.used + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+    if (offset + bytes > arena.capacity) return NULL;
+
+    arena.used = offset + bytes;
+    return arena.base != NULL ? arena.base + offset : NULL;
+}
+
+template <typename T>
+T* ArenaArray(Arena& arena, int count)
+{
+    return (T*)ArenaAlloc(arena, sizeof(T) * (size_t)count);
+}
+
+// Frees everything carved so far at once
+void ArenaReset(Arena& arena)
+{
+    arena.used = 0;
+}
+
+void CarveColumns(Arena& arena, EnemyColumns& cols, int capacity)
+{
+    cols.x = ArenaArray<float>(arena, capacity);
+    cols.y = ArenaArray<float>(arena, capacity);
+    cols.prevY = ArenaArray<float>(arena, capacity);
+    cols.speed = ArenaArray<float>(arena, capacity);
+    cols.health = ArenaArray<int>(arena, capacity);
+}
+
+void CarveColumns(Arena& arena, BulletColumns& cols, int capacity)
+{
+    cols.x = ArenaArray<float>(arena, capacity);
+    cols.y = ArenaArray<float>(arena, capacity);
+    cols.prevY = ArenaArray<float>(arena, capacity);
+}
+
+void CarveColumns(Arena& arena, BossBulletColumns& cols, int capacity)
+{
+    cols.x = ArenaArray<float>(arena, capacity);
+    cols.y = ArenaArray<float>(arena, capacity);
+    cols.prevX = ArenaArray<float>(arena, capacity);
+    cols.prevY = ArenaArray<float>(arena, capacity);
+    cols.vx = ArenaArray<float>(arena, capacity);
+    cols.vy = ArenaArray<float>(arena, capacity);
+}
+
+// Points the pool at fresh arena storage; PoolInit must run before use.
+template <class Columns>
+void CarvePool(Arena& arena, Pool<Columns>& pool, int capacity)
+{
+    CarveColumns(arena, pool.cols, capacity);
+    pool.count = 0;
+    pool.capacity = capacity;
+    pool.keep = ArenaArray<unsigned char>(arena, capacity);
+    pool.found = ArenaArray<int>(arena, capacity);
+}
+
+// Resets the arena and lays the level's pools out from its start
+void CarveLevel(Arena& arena, EnemyPool& enemies, BulletPool& bullets, BossBulletPool& bossBullets,
+    const EntityCapacities& capacities)
+{
+    ArenaReset(arena);
+    CarvePool(arena, enemies, capacities.enemies);
+    CarvePool(arena, bullets, capacities.bullets);
+    CarvePool(arena, bossBullets, capacities.bossBullets);
+}
+
+// Sized by a dry run of CarveLevel, so the two can never disagree
+size_t LevelArenaBytes(const EntityCapacities& capacities)
+{
+    Arena measure = { NULL, NULL, SIZE_MAX, 0 };
+    EnemyPool enemies;
+    BulletPool bullets;
+    BossBulletPool bossBullets;
+    CarveLevel(measure, enemies, bullets, bossBullets, capacities);
+    return measure.used;
+}
+
+// The only allocation the level storage ever makes, done once per world
+void InitLevelArena(Arena& arena, EnemyPool& enemies, BulletPool& bullets, BossBulletPool& bossBullets,
+    const EntityCapacities& capacities)
+{
+    InitArena(arena, LevelArenaBytes(capacities));
+    CarveLevel(arena, enemies, bullets, bossBullets, capacities);
+    PoolInit(enemies);
+    PoolInit(bullets);
+    PoolInit(bossBullets);
+}
+
+// A level being torn down drops all of its storage at once; the pools are
+// carved again, empty, at the same capacities.
+void ResetLevelArena(Arena& arena, EnemyPool& enemies, BulletPool& bullets, BossBulletPool& bossBullets)
+{
+    EntityCapacities capacities = { enemies.capacity, bullets.capacity, bossBullets.capacity };
+    CarveLevel(arena, enemies, bullets, bossBullets, capacities);
+    PoolInit(enemies);
+    PoolInit(bullets);
+    PoolInit(bossBullets);
+}
+
+// ---------------------------------------------------------
+// SIMD kernels
+// ---------------------------------------------------------
+// y += speed * dt for every entity; anything that ends up below wrapBelow is
+// moved to wrapTo (and its previous position too, so it doesn't smear).
+void IntegrateAndWrapY(float y[], float prevY[], const float speed[], int count,
+    float dt, float wrapBelow, float wrapTo)
+{
+    int i = 0;
+#if defined(SIMD_AVX2)
+    const __m256 vdt = _mm256_set1_ps(dt);
+    const __m256 vlimit = _mm256_set1_ps(wrapBelow);
+    const __m256 vto = _mm256_set1_ps(wrapTo);
+    for (; i + 8 <= count; i += 8) {
+        __m256 py = _mm256_loadu_ps(y + i);
+        __m256 ny = _mm256_add_ps(py, _mm256_mul_ps(_mm256_loadu_ps(speed + i), vdt));
+        __m256 wrap = _mm256_cmp_ps(ny, vlimit, _CMP_GT_OQ);
+        _mm256_storeu_ps(y + i, _mm256_blendv_ps(ny, vto, wrap));
+        _mm256_storeu_ps(prevY + i, _mm256_blendv_ps(py, vto, wrap));
+    }
+#elif defined(SIMD_SSE2)
+    const __m128 vdt = _mm_set1_ps(dt);
+    const __m128 vlimit = _mm_set1_ps(wrapBelow);
+    const __m128 vto = _mm_set1_ps(wrapTo);
+    for (; i + 4 <= count; i += 4) {
+        __m128 py = _mm_loadu_ps(y + i);
+        __m128 ny = _mm_add_ps(py, _mm_mul_ps(_mm_loadu_ps(speed + i), vdt));
+        __m128 wrap = _mm_cmpgt_ps(ny, vlimit);
+        _mm_storeu_ps(y + i, _mm_or_ps(_mm_and_ps(wrap, vto), _mm_andnot_ps(wrap, ny)));
+        _mm_storeu_ps(prevY + i, _mm_or_ps(_mm_and_ps(wrap, vto), _mm_andnot_ps(wrap, py)));
+    }
+#endif
+    for (; i < count; i++) {
+        float py = y[i];
+        float ny = py + speed[i] * dt;
+        bool wrap = ny > wrapBelow;
+        y[i] = wrap ? wrapTo : ny;
+        prevY[i] = wrap ? wrapTo : py;
+    }
+}
+
+// y += dy for every entity, remembering the old position.
+void IntegrateY(float y[], float prevY[], int count, float dy)
+{
+    int i = 0;
+#if defined(SIMD_AVX2)
+    const __m256 vdy = _mm256_set1_ps(dy);
+    for (; i + 8 <= count; i += 8) {
+        __m256 py = _mm256_loadu_ps(y + i);
+        _mm256_storeu_ps(prevY + i, py);
+        _mm256_storeu_ps(y + i, _mm256_add_ps(py, vdy));
+    }
+#elif defined(SIMD_SSE2)
+    const __m128 vdy = _mm_set1_ps(dy);
+    for (; i + 4 <= count; i += 4) {
+        __m128 py = _mm_loadu_ps(y + i);
+        _mm_storeu_ps(prevY + i, py);
+        _mm_storeu_ps(y + i, _mm_add_ps(py, vdy));
+    }
+#endif
+    for (; i < count; i++) {
+        prevY[i] = y[i];
+        y[i] += dy;
+    }
+}
+
+// keep[i] = minY <= y[i] <= maxY. Returns how many entries are outside.
+int MarkInsideY(const float y[], int count, float minY, float maxY, unsigned char keep[])
+{
+    int outside = 0;
+    int i = 0;
+
+#if defined(SIMD_AVX2)
+    const __m256 vmin = _mm256_set1_ps(minY);
+    const __m256 vmax = _mm256_set1_ps(maxY);
+    for (; i + 8 <= count; i += 8) {
+        __m256 vy = _mm256_loadu_ps(y + i);
+        __m256 inside = _mm256_and_ps(_mm256_cmp_ps(vy, vmin, _CMP_GE_OQ), _mm256_cmp_ps(vy, vmax, _CMP_LE_OQ));
+        int mask = _mm256_movemask_ps(inside);
+        for (int lane = 0; lane < 8; lane++) {
+            keep[i + lane] = (mask >> lane) & 1;
+            outside += !((mask >> lane) & 1);
+        }
+    }
+#elif defined(SIMD_SSE2)
+    const __m128 vmin = _mm_set1_ps(minY);
+    const __m128 vmax = _mm_set1_ps(maxY);
+    for (; i + 4 <= count; i += 4) {
+        __m128 vy = _mm_loadu_ps(y + i);
+        __m128 inside = _mm_and_ps(_mm_cmpge_ps(vy, vmin), _mm_cmple_ps(vy, vmax));
+        int mask = _mm_movemask_ps(inside);
+        for (int lane = 0; lane < 4; lane++) {
+            keep[i + lane] = (mask >> lane) & 1;
+            outside += !((mask >> lane) & 1);
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        keep[i] = (y[i] >= minY) & (y[i] <= maxY);
+        outside += !keep[i];
+    }
+    return outside;
+}
+
+// Position += velocity * dt, remembering the old position. keep[i] = the
+// new position is inside [minX, maxX] x [minY, maxY], in the same pass.
+// Returns how many entries ended up outside.
+int IntegrateAndMarkInside(float x[], float y[], float prevX[], float prevY[], const float vx[], const float vy[],
+    int count, float dt, float minX, float maxX, float minY, float maxY, unsigned char keep[])
+{
+    int outside = 0;
+    int i = 0;
+
+#if defined(SIMD_AVX2)
+    const __m256 vdt = _mm256_set1_ps(dt);
+    const __m256 vminX = _mm256_set1_ps(minX);
+    const __m256 vmaxX = _mm256_set1_ps(maxX);
+    const __m256 vminY = _mm256_set1_ps(minY);
+    const __m256 vmaxY = _mm256_set1_ps(maxY);
+    for (; i + 8 <= count; i += 8) {
+        __m256 px = _mm256_loadu_ps(x + i);
+        __m256 py = _mm256_loadu_ps(y + i);
+        __m256 nx = _mm256_add_ps(px, _mm256_mul_ps(_mm256_loadu_ps(vx + i), vdt));
+        __m256 ny = _mm256_add_ps(py, _mm256_mul_ps(_mm256_loadu_ps(vy + i), vdt));
+        _mm256_storeu_ps(prevX + i, px);
+        _mm256_storeu_ps(prevY + i, py);
+        _mm256_storeu_ps(x + i, nx);
+        _mm256_storeu_ps(y + i, ny);
+        __m256 insideX = _mm256_and_ps(_mm256_cmp_ps(nx, vminX, _CMP_GE_OQ), _mm256_cmp_ps(nx, vmaxX, _CMP_LE_OQ));
+        __m256 insideY = _mm256_and_ps(_mm256_cmp_ps(ny, vminY, _CMP_GE_OQ), _mm256_cmp_ps(ny, vmaxY, _CMP_LE_OQ));
+        int mask = _mm256_movemask_ps(_mm256_and_ps(insideX, insideY));
+        for (int lane = 0; lane < 8; lane++) {
+            keep[i + lane] = (mask >> lane) & 1;
+            outside += !((mask >> lane) & 1);
+        }
+    }
+#elif defined(SIMD_SSE2)
+    const __m128 vdt = _mm_set1_ps(dt);
+    const __m128 vminX = _mm_set1_ps(minX);
+    const __m128 vmaxX = _mm_set1_ps(maxX);
+    const __m128 vminY = _mm_set1_ps(minY);
+    const __m128 vmaxY = _mm_set1_ps(maxY);
+    for (; i + 4 <= count; i += 4) {
+        __m128 px = _mm_loadu_ps(x + i);
+        __m128 py = _mm_loadu_ps(y + i);
+        __m128 nx = _mm_add_ps(px, _mm_mul_ps(_mm_loadu_ps(vx + i), vdt));
+        __m128 ny = _mm_add_ps(py, _mm_mul_ps(_mm_loadu_ps(vy + i), vdt));
+        _mm_storeu_ps(prevX + i, px);
+        _mm_storeu_ps(prevY + i, py);
+        _mm_storeu_ps(x + i, nx);
+        _mm_storeu_ps(y + i, ny);
+        __m128 insideX = _mm_and_ps(_mm_cmpge_ps(nx, vminX), _mm_cmple_ps(nx, vmaxX));
+        __m128 insideY = _mm_and_ps(_mm_cmpge_ps(ny, vminY), _mm_cmple_ps(ny, vmaxY));
+        int mask = _mm_movemask_ps(_mm_and_ps(insideX, insideY));
+        for (int lane = 0; lane < 4; lane++) {
+            keep[i + lane] = (mask >> lane) & 1;
+            outside += !((mask >> lane) & 1);
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        prevX[i] = x[i];
+        prevY[i] = y[i];
+        x[i] += vx[i] * dt;
+        y[i] += vy[i] * dt;
+        keep[i] = (x[i] >= minX) & (x[i] <= maxX) & (y[i] >= minY) & (y[i] <= maxY);
+        outside += !keep[i];
+    }
+    return outside;
+}
+
+// One particle step: velocity is damped and pulled down by gravity, the
+// position follows it and life counts down. keep[i] = life still > 0, in
+// the same pass. Returns how many particles died.
+int IntegrateParticles(float x[], float y[], float prevX[], float prevY[], float vx[], float vy[], float life[],
+    int count, float dt, float gravity, float damping, unsigned char keep[])
+{
+    int dead = 0;
+    int i = 0;
+    const float gdt = gravity * dt;
+
+#if defined(SIMD_AVX2)
+    const __m256 vdt = _mm256_set1_ps(dt);
+    const __m256 vgdt = _mm256_set1_ps(gdt);
+    const __m256 vdamp = _mm256_set1_ps(damping);
+    const __m256 vzero = _mm256_setzero_ps();
+    for (; i + 8 <= count; i += 8) {
+        __m256 px = _mm256_loadu_ps(x + i);
+        __m256 py = _mm256_loadu_ps(y + i);
+        __m256 nvx = _mm256_mul_ps(_mm256_loadu_ps(vx + i), vdamp);
+        __m256 nvy = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(vy + i), vdamp), vgdt);
+        __m256 nlife = _mm256_sub_ps(_mm256_loadu_ps(life + i), vdt);
+        _mm256_storeu_ps(prevX + i, px);
+        _mm256_storeu_ps(prevY + i, py);
+        _mm256_storeu_ps(vx + i, nvx);
+        _mm256_storeu_ps(vy + i, nvy);
+        _mm256_storeu_ps(x + i, _mm256_add_ps(px, _mm256_mul_ps(nvx, vdt)));
+        _mm256_storeu_ps(y + i, _mm256_add_ps(py, _mm256_mul_ps(nvy, vdt)));
+        _mm256_storeu_ps(life + i, nlife);
+        int mask = _mm256_movemask_ps(_mm256_cmp_ps(nlife, vzero, _CMP_GT_OQ));
+        for (int lane = 0; lane < 8; lane++) {
+            keep[i + lane] = (mask >> lane) & 1;
+            dead += !((mask >> lane) & 1);
+        }
+    }
+#elif defined(SIMD_SSE2)
+    const __m128 vdt = _mm_set1_ps(dt);
+    const __m128 vgdt = _mm_set1_ps(gdt);
+    const __m128 vdamp = _mm_set1_ps(damping);
+    const __m128 vzero = _mm_setzero_ps();
+    for (; i + 4 <= count; i += 4) {
+        __m128 px = _mm_loadu_ps(x + i);
+        __m128 py = _mm_loadu_ps(y + i);
+        __m128 nvx = _mm_mul_ps(_mm_loadu_ps(vx + i), vdamp);
+        __m128 nvy = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(vy + i), vdamp), vgdt);
+        __m128 nlife = _mm_sub_ps(_mm_loadu_ps(life + i), vdt);
+        _mm_storeu_ps(prevX + i, px);
+        _mm_storeu_ps(prevY + i, py);
+        _mm_storeu_ps(vx + i, nvx);
+        _mm_storeu_ps(vy + i, nvy);
+        _mm_storeu_ps(x + i, _mm_add_ps(px, _mm_mul_ps(nvx, vdt)));
+        _mm_storeu_ps(y + i, _mm_add_ps(py, _mm_mul_ps(nvy, vdt)));
+        _mm_storeu_ps(life + i, nlife);
+        int mask = _mm_movemask_ps(_mm_cmpgt_ps(nlife, vzero));
+        for (int lane = 0; lane < 4; lane++) {
+            keep[i + lane] = (mask >> lane) & 1;
+            dead += !((mask >> lane) & 1);
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        prevX[i] = x[i];
+        prevY[i] = y[i];
+        vx[i] = vx[i] * damping;
+        vy[i] = vy[i] * damping + gdt;
+        x[i] += vx[i] * dt;
+        y[i] += vy[i] * dt;
+        life[i] -= dt;
+        keep[i] = life[i] > 0.0f;
+        dead += !keep[i];
+    }
+    return dead;
+}
+
+// ---------------------------------------------------------
+// Particles
+// ---------------------------------------------------------
+void InitParticles(ParticleSystem& ps, unsigned int seed)
+{
+    ps.count = 0;
+    ps.drops = 0;
+    RngSeed(ps.rng, seed, RNG_STREAM_COUNT);
+}
+
+// Spawns count particles at (x, y), each heading up to spread / 2 radians
+// either side of angle. Lifetimes vary so a burst thins out gradually.
+void EmitParticles(ParticleSystem& ps, float x, float y, int count, float angle, float spread,
+    float minSpeed, float maxSpeed, float life, float size, Color color)
+{
+    for (int n = 0; n < count; n++) {
+        if (ps.count >= MAX_PARTICLES) {
+            ps.drops += count - n;
+            return;
+        }
+
+        int i = ps.count++;
+        float a = angle + (RngFloat(ps.rng) - 0.5f) * spread;
+        float speed = minSpeed + (maxSpeed - minSpeed) * RngFloat(ps.rng);
+        ps.x[i] = x;
+        ps.y[i] = y;
+        ps.prevX[i] = x;
+        ps.prevY[i] = y;
+        ps.vx[i] = cosf(a) * speed;
+        ps.vy[i] = sinf(a) * speed;
+        ps.life[i] = life * (0.5f + 0.5f * RngFloat(ps.rng));
+        ps.size[i] = size;
+        ps.color[i] = color;
+    }
+}
+
+// Called once per tick with the tick's events. Event positions are the
+// top-left corners the simulation reported, so bursts are centred here.
+void SpawnEventParticles(ParticleSystem& ps, const GameEvents& events, const Player& player)
+{
+    const float FULL_CIRCLE = 2.0f * PI;
+    const float UP = -PI / 2.0f;
+    const float DOWN = PI / 2.0f;
+
+    for (int i = 0; i < events.count; i++) {
+        float x = events.items[i].x;
+        float y = events.items[i].y;
+
+        switch (events.items[i].type) {
+        case EVENT_PLAYER_SHOT:
+            EmitParticles(ps, x + BULLET_WIDTH / 2.0f, y + BULLET_HEIGHT, 10, UP, 0.8f,
+                120.0f, 260.0f, 0.15f, 3.0f, YELLOW);
+            break;
+        case EVENT_BOSS_SHOT:
+            EmitParticles(ps, x, y, 6, DOWN, 0.8f, 100.0f, 200.0f, 0.15f, 3.0f, RED);
+            break;
+        case EVENT_ENEMY_HIT:
+            EmitParticles(ps, x + ENEMY_WIDTH / 2.0f, y + ENEMY_HEIGHT, 8, DOWN, 2.0f,
+                60.0f, 180.0f, 0.3f, 3.0f, GOLD);
+            break;
+        case EVENT_ENEMY_KILLED:
+            EmitParticles(ps, x + ENEMY_WIDTH / 2.0f, y + ENEMY_HEIGHT / 2.0f, 48, 0.0f, FULL_CIRCLE,
+                60.0f, 260.0f, 0.9f, 4.0f, ORANGE);
+            EmitParticles(ps, x + ENEMY_WIDTH / 2.0f, y + ENEMY_HEIGHT / 2.0f, 16, 0.0f, FULL_CIRCLE,
+                20.0f, 120.0f, 0.5f, 6.0f, YELLOW);
+            break;
+        case EVENT_BOSS_HIT:
+            EmitParticles(ps, x + BULLET_WIDTH / 2.0f, y, 12, DOWN, 2.0f, 80.0f, 220.0f, 0.4f, 3.0f, GOLD);
+            break;
+        case EVENT_BOSS_DEFEATED:
+            EmitParticles(ps, x + BOSS_WIDTH / 2.0f, y + BOSS_HEIGHT / 2.0f, 1200, 0.0f, FULL_CIRCLE,
+                80.0f, 520.0f, 2.0f, 6.0f, ORANGE);
+            EmitParticles(ps, x + BOSS_WIDTH / 2.0f, y + BOSS_HEIGHT / 2.0f, 300, 0.0f, FULL_CIRCLE,
+                40.0f, 300.0f, 1.5f, 8.0f, WHITE);
+            break;
+        case EVENT_PLAYER_HIT:
+            EmitParticles(ps, x + player.width / 2.0f, y + player.height / 2.0f, 120, 0.0f, FULL_CIRCLE,
+                60.0f, 320.0f, 1.2f, 5.0f, SKYBLUE);
+            break;
+        case EVENT_GAME_OVER:
+            break;
+        case EVENT_GAME_RESTARTED:
+        case EVENT_GAME_LOADED:
+            ps.count = 0;
+            break;
+        }
+    }
+}
+
+void MoveParticle(ParticleSystem& ps, int dst, int src)
+{
+    ps.x[dst] = ps.x[src];
+    ps.y[dst] = ps.y[src];
+    ps.prevX[dst] = ps.prevX[src];
+    ps.prevY[dst] = ps.prevY[src];
+    ps.vx[dst] = ps.vx[src];
+    ps.vy[dst] = ps.vy[src];
+    ps.life[dst] = ps.life[src];
+    ps.size[dst] = ps.size[src];
+    ps.color[dst] = ps.color[src];
+}
+
+// Draw order doesn't matter under additive blending, so dead particles are
+// swap-removed: walking down from the end, everything past i is alive.
+void UpdateParticles(ParticleSystem& ps, float dt)
+{
+    float damping = 1.0f - PARTICLE_DRAG * dt;
+    if (damping < 0.0f) damping = 0.0f;
+
+    int dead = IntegrateParticles(ps.x, ps.y, ps.prevX, ps.prevY, ps.vx, ps.vy, ps.life,
+        ps.count, dt, PARTICLE_GRAVITY, damping, ps.keep);
+    if (dead == 0) return;
+
+    for (int i = ps.count - 1; i >= 0; i--) {
+        if (!ps.keep[i]) {
+            ps.count--;
+            if (i != ps.count) MoveParticle(ps, i, ps.count);
+        }
+    }
+}
+
+// Additive quads textured from the middle of the atlas's white block, so
+// every particle shares the sprite pass's texture. Emitted in chunks that
+// fit one rlgl batch; each chunk costs a draw call, not each particle.
+void DrawParticles(const ParticleSystem& ps, const SpriteAtlas& atlas, float alpha)
+{
+    if (ps.count == 0) return;
+
+    const Rectangle& white = atlas.regions[SPRITE_WHITE];
+    const float u = (white.x + white.width * 0.5f) / atlas.texture.width;
+    const float v = (white.y + white.height * 0.5f) / atlas.texture.height;
+
+    BeginBlendMode(BLEND_ADDITIVE);
+
+    for (int first = 0; first < ps.count; first += PARTICLE_DRAW_CHUNK) {
+        int last = first + PARTICLE_DRAW_CHUNK < ps.count ? first + PARTICLE_DRAW_CHUNK : ps.count;
+
+        // A flush resets the texture, so set it after the check
+        rlCheckRenderBatchLimit(4 * (last - first));
+        rlSetTexture(atlas.texture.id);
+        rlBegin(RL_QUADS);
+        rlNormal3f(0.0f, 0.0f, 1.0f);
+
+        for (int i = first; i < last; i++) {
+            float x = ps.prevX[i] + (ps.x[i] - ps.prevX[i]) * alpha;
+            float y = ps.prevY[i] + (ps.y[i] - ps.prevY[i]) * alpha;
+            float h = ps.size[i] * 0.5f;
+            // Fade out over the last quarter second
+            float fade = ps.life[i] < 0.25f ? ps.life[i] * 4.0f : 1.0f;
+            Color c = ps.color[i];
+
+            rlColor4ub(c.r, c.g, c.b, (unsigned char)(c.a * fade));
+            rlTexCoord2f(u, v); rlVertex2f(x - h, y - h);
+            rlTexCoord2f(u, v); rlVertex2f(x - h, y + h);
+            rlTexCoord2f(u, v); rlVertex2f(x + h, y + h);
+            rlTexCoord2f(u, v); rlVertex2f(x + h, y - h);
+        }
+
+        rlEnd();
+    }
+
+    rlSetTexture(0);
+    EndBlendMode();
+}
+
+// ---------------------------------------------------------
+// Broadphase (uniform grid)
+// ---------------------------------------------------------
+void InitSpatialGrid(SpatialGrid& grid, float originX, float originY,
+    float width, float height, float cellSize)
+{
+    grid.originX = originX;
+    grid.originY = originY;
+    grid.cellSize = cellSize;
+    grid.cols = (int)ceilf(width / cellSize);
+    grid.rows = (int)ceilf(height / cellSize);
+    if (grid.cols < 1) grid.cols = 1;
+    if (grid.rows < 1) grid.rows = 1;
+    grid.count = 0;
+    grid.maxStep = 0.0f;
+    grid.cellStart.assign(grid.cols * grid.rows + 1, 0);
+    grid.cellOf.clear();
+    grid.items.clear();
+}
+
+void InitBroadphase(Broadphase& broadphase, const EntityCapacities& capacities)
+{
+    InitSpatialGrid(broadphase.enemies, 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, GRID_CELL_SIZE);
+    InitSpatialGrid(broadphase.bossBullets, 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, GRID_CELL_SIZE);
+    broadphase.enemies.cellOf.reserve(capacities.enemies);
+    broadphase.enemies.items.reserve(capacities.enemies);
+    broadphase.bossBullets.cellOf.reserve(capacities.bossBullets);
+    broadphase.bossBullets.items.reserve(capacities.bossBullets);
+}
+
+int GridCellCoord(float value, float origin, float cellSize, int cells)
+{
+    int c = (int)floorf((value - origin) / cellSize);
+    if (c < 0) c = 0;
+    if (c >= cells) c = cells - 1;
+    return c;
+}
+
+// O(n) counting sort of entity indices by cell. Storage only grows, so a
+// steady-state rebuild does not allocate.
+void BuildSpatialGrid(SpatialGrid& grid, const float xs[], const float ys[], int count)
+{
+    int numCells = grid.cols * grid.rows;
+    if ((int)grid.cellOf.size() < count) {
+        grid.cellOf.resize(count);
+        grid.items.resize(count);
+    }
+
+    int* start = grid.cellStart.data();
+    memset(start, 0, sizeof(int) * (numCells + 1));
+
+    for (int i = 0; i < count; i++) {
+        int cx = GridCellCoord(xs[i], grid.originX, grid.cellSize, grid.cols);
+        int cy = GridCellCoord(ys[i], grid.originY, grid.cellSize, grid.rows);
+        int cell = cy * grid.cols + cx;
+        grid.cellOf[i] = cell;
+        start[cell + 1]++;
+    }
+
+    for (int c = 0; c < numCells; c++) {
+        start[c + 1] += start[c];
+    }
+
+    // Fill using the next-free offset of each cell, then shift back
+    for (int i = 0; i < count; i++) {
+        grid.items[start[grid.cellOf[i]]++] = i;
+    }
+    for (int c = numCells; c > 0; c--) {
+        start[c] = start[c - 1];
+    }
+    start[0] = 0;
+
+    grid.count = count;
+}
+
+// Writes the indices of every entity that may overlap the box to out and
+// returns how many were written. Callers still run the narrowphase test.
+int QuerySpatialGrid(const SpatialGrid& grid, float x, float y, float w, float h,
+    int out[], int maxOut)
+{
+    int cx0 = GridCellCoord(x - grid.cellSize, grid.originX, grid.cellSize, grid.cols);
+    int cy0 = GridCellCoord(y - grid.cellSize, grid.originY, grid.cellSize, grid.rows);
+    int cx1 = GridCellCoord(x + w, grid.originX, grid.cellSize, grid.cols);
+    int cy1 = GridCellCoord(y + h, grid.originY, grid.cellSize, grid.rows);
+
+    int found = 0;
+    for (int cy = cy0; cy <= cy1; cy++) {
+        int rowStart = grid.cellStart[cy * grid.cols + cx0];
+        int rowEnd = grid.cellStart[cy * grid.cols + cx1 + 1];
+        for (int k = rowStart; k < rowEnd && found < maxOut; k++) {
+            out[found++] = grid.items[k];
+        }
+    }
+    return found;
+}
+
+// Largest per-axis distance between positions and previous, i.e. how far
+// the fastest entity moved this tick
+float MaxStep(const float positions[], const float previous[], int count)
+{
+    float step = 0.0f;
+    for (int i = 0; i < count; i++) {
+        float d = fabsf(positions[i] - previous[i]);
+        if (d > step) step = d;
+    }
+    return step;
+}
+
+// Candidates for a box at (x, y) that moved by (dx, dy) this tick: the
+// union of its start and end boxes, grown by how far the grid's own
+// entities moved (grid.maxStep) since they are bucketed where they ended
+int QuerySweptBox(const SpatialGrid& grid, float x, float y, float w, float h, float dx, float dy,
+    int out[], int maxOut)
+{
+    float reach = grid.maxStep;
+    float left = (dx > 0 ? x - dx : x) - reach;
+    float top = (dy > 0 ? y - dy : y) - reach;
+    return QuerySpatialGrid(grid, left, top, w + fabsf(dx) + 2 * reach, h + fabsf(dy) + 2 * reach, out, maxOut);
+}
+
+// Compares an all-pairs bullet/enemy test against the grid at growing
+// entity counts, both finding each bullet's first hit over one tick with
+// the swept narrowphase. The field grows with the count so density stays
+// constant.
+void RunBroadphaseBenchmark()
+{
+    const int counts[] = { 100, 1000, 5000, 10000, 20000, 50000 };
+    const int NAIVE_LIMIT = 20000;
+
+    static int candidates[MAX_QUERY_RESULTS];
+    Rng rng;
+    RngSeed(rng, BENCH_SEED, 0);
+
+    cout << "entities,naive_ms,grid_build_ms,grid_query_ms,grid_ns_per_entity,hits\n";
+
+    for (int n : counts) {
+        float side = sqrtf(n * BENCH_AREA_PER_ENTITY);
+        // Bullets fly straight up; enemies fall at the speeds a wave uses
+        const float bulletDy = -BULLET_SPEED / DEFAULT_TICK_RATE;
+        vector<float> ex(n), ey(n), eprevY(n), bx(n), by(n);
+        for (int i = 0; i < n; i++) {
+            ex[i] = (float)RngRange(rng, 0, (int)side);
+            ey[i] = (float)RngRange(rng, 0, (int)side);
+            eprevY[i] = ey[i] - (float)RngRange(rng, 30, 120) / DEFAULT_TICK_RATE;
+            bx[i] = (float)RngRange(rng, 0, (int)side);
+            by[i] = (float)RngRange(rng, 0, (int)side);
+        }
+
+        // Earliest hit per bullet, lowest enemy index on a tie, as
+        // FirstHitInCandidates picks it
+        double naiveMs = -1.0;
+        vector<int> naiveTargets;
+        if (n <= NAIVE_LIMIT) {
+            naiveTargets.resize(n);
+            auto t0 = chrono::steady_clock::now();
+            for (int i = 0; i < n; i++) {
+                int best = -1;
+                float bestTime = -1.0f;
+                for (int j = 0; j < n; j++) {
+                    float time = SweptHitTime(bx[i], by[i], BULLET_WIDTH, BULLET_HEIGHT, 0.0f, bulletDy,
+                        ex[j], ey[j], ENEMY_WIDTH, ENEMY_HEIGHT, 0.0f, ey[j] - eprevY[j]);
+                    if (time >= 0.0f && (best < 0 || time < bestTime)) {
+                        best = j;
+                        bestTime = time;
+                    }
+                }
+                naiveTargets[i] = best;
+            }
+            naiveMs = chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+        }
+
+        SpatialGrid grid;
+        InitSpatialGrid(grid, 0, 0, side, side, GRID_CELL_SIZE);
+
+        auto t1 = chrono::steady_clock::now();
+        BuildSpatialGrid(grid, ex.data(), ey.data(), n);
+        grid.maxStep = MaxStep(ey.data(), eprevY.data(), n);
+        auto t2 = chrono::steady_clock::now();
+
+        // Candidates go through the batched swept narrowphase; every bullet
+        // must pick the same target as the scalar all-pairs pass
+        long long gridHits = 0;
+        long long mismatches = 0;
+        for (int i = 0; i < n; i++) {
+            int found = QuerySweptBox(grid, bx[i], by[i], BULLET_WIDTH, BULLET_HEIGHT, 0.0f, bulletDy,
+                candidates, MAX_QUERY_RESULTS);
+            float hitTime;
+            int target = FirstHitInCandidates(bx[i], by[i], BULLET_WIDTH, BULLET_HEIGHT, 0.0f, bulletDy,
+                ex.data(), ey.data(), ex.data(), eprevY.data(), ENEMY_WIDTH, ENEMY_HEIGHT, candidates, found, hitTime);
+            gridHits += target >= 0;
+            if (naiveMs >= 0 && target != naiveTargets[i]) mismatches++;
+        }
+        auto t3 = chrono::steady_clock::now();
+
+        double buildMs = chrono::duration<double, milli>(t2 - t1).count();
+        double queryMs = chrono::duration<double, milli>(t3 - t2).count();
+
+        if (mismatches > 0) {
+            cout << "# mismatch at " << n << ": " << mismatches << " bullets picked a different target\n";
+        }
+
+        cout << n << ','
+            << naiveMs << ','
+            << buildMs << ','
+            << queryMs << ','
+            << (buildMs + queryMs) * 1e6 / n << ','
+            << gridHits << '\n';
+    }
+}
+
+// ---------------------------------------------------------
+// Narrowphase (swept AABB tests)
+// ---------------------------------------------------------
+// Swept AABB test over one tick. Both boxes are given where they ended
+// the tick along with how far they moved during it. Returns the fraction
+// of the tick in [0, 1] at which they first overlap, or -1 if they never
+// do, so a fast box can't pass through another between ticks. Overlap is
+// strict (boxes that only touch don't count), and boxes overlapping at the
+// end always count (as 1 if rounding put the entry time past the end).
+float SweptHitTime(float ax, float ay, float aw, float ah, float adx, float ady,
+    float bx, float by, float bw, float bh, float bdx, float bdy)
+{
+    // In B's frame B stays at its start and A moves by the difference
+    const float infinity = numeric_limits<float>::infinity();
+    const float a0[2] = { ax - adx, ay - ady };
+    const float a1[2] = { a0[0] + aw, a0[1] + ah };
+    const float b0[2] = { bx - bdx, by - bdy };
+    const float b1[2] = { b0[0] + bw, b0[1] + bh };
+    const float d[2] = { adx - bdx, ady - bdy };
+
+    float enter = 0.0f;
+    float exit = 1.0f;
+    for (int axis = 0; axis < 2; axis++) {
+        float lo;
+        float hi;
+        if (d[axis] != 0.0f) {
+            float t0 = (b0[axis] - a1[axis]) / d[axis];
+            float t1 = (b1[axis] - a0[axis]) / d[axis];
+            lo = t1 < t0 ? t1 : t0;
+            hi = t1 > t0 ? t1 : t0;
+        }
+        else {
+            bool still = (a0[axis] < b1[axis]) & (a1[axis] > b0[axis]);
+            lo = still ? -infinity : infinity;
+            hi = infinity;
+        }
+        enter = lo > enter ? lo : enter;
+        exit = hi < exit ? hi : exit;
+    }
+
+    if (enter < exit) return enter;
+    bool overlapsAtEnd = (ax < bx + bw) & (ax + aw > bx) & (ay < by + bh) & (ay + ah > by);
+    return overlapsAtEnd ? 1.0f : -1.0f;
+}
+
+// SweptHitTime of box A against count boxes of one size packed in bx/by
+// with their steps in bdx/bdy. Uses exactly the operations of the scalar
+// version, so every lane matches it bit for bit.
+void SweptHitTimeBatch(float ax, float ay, float aw, float ah, float adx, float ady,
+    const float bx[], const float by[], const float bdx[], const float bdy[], float bw, float bh, int count, float times[])
+{
+    const float ax0 = ax - adx;
+    const float ay0 = ay - ady;
+    const float ax1 = ax0 + aw;
+    const float ay1 = ay0 + ah;
+    const float axEnd1 = ax + aw;
+    const float ayEnd1 = ay + ah;
+    int i = 0;
+
+#if defined(SIMD_AVX2)
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 minusOne = _mm256_set1_ps(-1.0f);
+    const __m256 inf = _mm256_set1_ps(numeric_limits<float>::infinity());
+    const __m256 minusInf = _mm256_set1_ps(-numeric_limits<float>::infinity());
+    const __m256 vbw = _mm256_set1_ps(bw);
+    const __m256 vbh = _mm256_set1_ps(bh);
+    for (; i + 8 <= count; i += 8) {
+        __m256 x = _mm256_loadu_ps(bx + i);
+        __m256 y = _mm256_loadu_ps(by + i);
+        __m256 dxB = _mm256_loadu_ps(bdx + i);
+        __m256 dyB = _mm256_loadu_ps(bdy + i);
+        __m256 enter = zero;
+        __m256 exit = one;
+
+        // x axis, then y axis; a lane with no relative motion either always
+        // or never overlaps on that axis
+        __m256 b0 = _mm256_sub_ps(x, dxB);
+        __m256 b1 = _mm256_add_ps(b0, vbw);
+        __m256 d = _mm256_sub_ps(_mm256_set1_ps(adx), dxB);
+        __m256 t0 = _mm256_div_ps(_mm256_sub_ps(b0, _mm256_set1_ps(ax1)), d);
+        __m256 t1 = _mm256_div_ps(_mm256_sub_ps(b1, _mm256_set1_ps(ax0)), d);
+        __m256 moving = _mm256_cmp_ps(d, zero, _CMP_NEQ_OQ);
+        __m256 still = _mm256_and_ps(_mm256_cmp_ps(_mm256_set1_ps(ax0), b1, _CMP_LT_OQ),
+            _mm256_cmp_ps(_mm256_set1_ps(ax1), b0, _CMP_GT_OQ));
+        __m256 lo = _mm256_blendv_ps(_mm256_blendv_ps(inf, minusInf, still), _mm256_min_ps(t1, t0), moving);
+        __m256 hi = _mm256_blendv_ps(inf, _mm256_max_ps(t1, t0), moving);
+        enter = _mm256_max_ps(lo, enter);
+        exit = _mm256_min_ps(hi, exit);
+
+        b0 = _mm256_sub_ps(y, dyB);
+        b1 = _mm256_add_ps(b0, vbh);
+        d = _mm256_sub_ps(_mm256_set1_ps(ady), dyB);
+        t0 = _mm256_div_ps(_mm256_sub_ps(b0, _mm256_set1_ps(ay1)), d);
+        t1 = _mm256_div_ps(_mm256_sub_ps(b1, _mm256_set1_ps(ay0)), d);
+        moving = _mm256_cmp_ps(d, zero, _CMP_NEQ_OQ);
+        still = _mm256_and_ps(_mm256_cmp_ps(_mm256_set1_ps(ay0), b1, _CMP_LT_OQ),
+            _mm256_cmp_ps(_mm256_set1_ps(ay1), b0, _CMP_GT_OQ));
+        lo = _mm256_blendv_ps(_mm256_blendv_ps(inf, minusInf, still), _mm256_min_ps(t1, t0), moving);
+        hi = _mm256_blendv_ps(inf, _mm256_max_ps(t1, t0), moving);
+        enter = _mm256_max_ps(lo, enter);
+        exit = _mm256_min_ps(hi, exit);
+
+        __m256 hit = _mm256_cmp_ps(enter, exit, _CMP_LT_OQ);
+        __m256 atEnd = _mm256_and_ps(
+            _mm256_and_ps(_mm256_cmp_ps(_mm256_set1_ps(ax), _mm256_add_ps(x, vbw), _CMP_LT_OQ),
+                _mm256_cmp_ps(_mm256_set1_ps(axEnd1), x, _CMP_GT_OQ)),
+            _mm256_and_ps(_mm256_cmp_ps(_mm256_set1_ps(ay), _mm256_add_ps(y, vbh), _CMP_LT_OQ),
+                _mm256_cmp_ps(_mm256_set1_ps(ayEnd1), y, _CMP_GT_OQ)));
+        __m256 time = _mm256_blendv_ps(_mm256_blendv_ps(minusOne, one, atEnd), enter, hit);
+        _mm256_storeu_ps(times + i, time);
+    }
+#elif defined(SIMD_SSE2)
+    // SSE2 has no blendv, so selects are and/andnot/or
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 minusOne = _mm_set1_ps(-1.0f);
+    const __m128 inf = _mm_set1_ps(numeric_limits<float>::infinity());
+    const __m128 minusInf = _mm_set1_ps(-numeric_limits<float>::infinity());
+    const __m128 vbw = _mm_set1_ps(bw);
+    const __m128 vbh = _mm_set1_ps(bh);
+    for (; i + 4 <= count; i += 4) {
+        __m128 x = _mm_loadu_ps(bx + i);
+        __m128 y = _mm_loadu_ps(by + i);
+        __m128 dxB = _mm_loadu_ps(bdx + i);
+        __m128 dyB = _mm_loadu_ps(bdy + i);
+        __m128 enter = zero;
+        __m128 exit = one;
+
+        __m128 b0 = _mm_sub_ps(x, dxB);
+        __m128 b1 = _mm_add_ps(b0, vbw);
+        __m128 d = _mm_sub_ps(_mm_set1_ps(adx), dxB);
+        __m128 t0 = _mm_div_ps(_mm_sub_ps(b0, _mm_set1_ps(ax1)), d);
+        __m128 t1 = _mm_div_ps(_mm_sub_ps(b1, _mm_set1_ps(ax0)), d);
+        __m128 moving = _mm_cmpneq_ps(d, zero);
+        __m128 still = _mm_and_ps(_mm_cmplt_ps(_mm_set1_ps(ax0), b1), _mm_cmpgt_ps(_mm_set1_ps(ax1), b0));
+        __m128 stillLo = _mm_or_ps(_mm_and_ps(still, minusInf), _mm_andnot_ps(still, inf));
+        __m128 lo = _mm_or_ps(_mm_and_ps(moving, _mm_min_ps(t1, t0)), _mm_andnot_ps(moving, stillLo));
+        __m128 hi = _mm_or_ps(_mm_and_ps(moving, _mm_max_ps(t1, t0)), _mm_andnot_ps(moving, inf));
+        enter = _mm_max_ps(lo, enter);
+        exit = _mm_min_ps(hi, exit);
+
+        b0 = _mm_sub_ps(y, dyB);
+        b1 = _mm_add_ps(b0, vbh);
+        d = _mm_sub_ps(_mm_set1_ps(ady), dyB);
+        t0 = _mm_div_ps(_mm_sub_ps(b0, _mm_set1_ps(ay1)), d);
+        t1 = _mm_div_ps(_mm_sub_ps(b1, _mm_set1_ps(ay0)), d);
+        moving = _mm_cmpneq_ps(d, zero);
+        still = _mm_and_ps(_mm_cmplt_ps(_mm_set1_ps(ay0), b1), _mm_cmpgt_ps(_mm_set1_ps(ay1), b0));
+        stillLo = _mm_or_ps(_mm_and_ps(still, minusInf), _mm_andnot_ps(still, inf));
+        lo = _mm_or_ps(_mm_and_ps(moving, _mm_min_ps(t1, t0)), _mm_andnot_ps(moving, stillLo));
+        hi = _mm_or_ps(_mm_and_ps(moving, _mm_max_ps(t1, t0)), _mm_andnot_ps(moving, inf));
+        enter = _mm_max_ps(lo, enter);
+        exit = _mm_min_ps(hi, exit);
+
+        __m128 hit = _mm_cmplt_ps(enter, exit);
+        __m128 atEnd = _mm_and_ps(
+            _mm_and_ps(_mm_cmplt_ps(_mm_set1_ps(ax), _mm_add_ps(x, vbw)), _mm_cmpgt_ps(_mm_set1_ps(axEnd1), x)),
+            _mm_and_ps(_mm_cmplt_ps(_mm_set1_ps(ay), _mm_add_ps(y, vbh)), _mm_cmpgt_ps(_mm_set1_ps(ayEnd1), y)));
+        __m128 miss = _mm_or_ps(_mm_and_ps(atEnd, one), _mm_andnot_ps(atEnd, minusOne));
+        _mm_storeu_ps(times + i, _mm_or_ps(_mm_and_ps(hit, enter), _mm_andnot_ps(hit, miss)));
+    }
+#endif
+    for (; i < count; i++) {
+        times[i] = SweptHitTime(ax, ay, aw, ah, adx, ady, bx[i], by[i], bw, bh, bdx[i], bdy[i]);
+    }
+}
+
+// Gathers the broadphase candidates' end positions and steps into packed
+// blocks, runs the batch test and returns the entity A hits earliest in the
+// tick (the lowest index on a tie), or -1. hitTime gets its time of impact.
+int FirstHitInCandidates(float ax, float ay, float aw, float ah, float adx, float ady,
+    const float xs[], const float ys[], const float prevXs[], const float prevYs[], float bw, float bh,
+    const int candidates[], int found, float& hitTime)
+{
+    float cx[OVERLAP_BATCH];
+    float cy[OVERLAP_BATCH];
+    float cdx[OVERLAP_BATCH];
+    float cdy[OVERLAP_BATCH];
+    float times[OVERLAP_BATCH];
+    int best = -1;
+    hitTime = -1.0f;
+
+    for (int base = 0; base < found; base += OVERLAP_BATCH) {
+        int n = found - base < OVERLAP_BATCH ? found - base : OVERLAP_BATCH;
+        for (int k = 0; k < n; k++) {
+            int c = candidates[base + k];
+            cx[k] = xs[c];
+            cy[k] = ys[c];
+            cdx[k] = xs[c] - prevXs[c];
+            cdy[k] = ys[c] - prevYs[c];
+        }
+
+        SweptHitTimeBatch(ax, ay, aw, ah, adx, ady, cx, cy, cdx, cdy, bw, bh, n, times);
+        for (int k = 0; k < n; k++) {
+            if (times[k] < 0.0f) continue;
+            int index = candidates[base + k];
+            if (best < 0 || times[k] < hitTime || (times[k] == hitTime && index < best)) {
+                best = index;
+                hitTime = times[k];
+            }
+        }
+    }
+    return best;
+}
+
+// ---------------------------------------------------------
+// Simulation step (no window, input or audio access)
+// ---------------------------------------------------------
+// Never drops an event: score and lost lives are applied from the queue
+void PushEvent(GameEvents& events, GameEventType type, float x, float y)
+{
+    if (events.count >= (int)events.items.size()) {
+        events.items.resize(events.items.empty() ? INITIAL_GAME_EVENTS : events.items.size() * 2);
+    }
+
+    events.items[events.count].type = type;
+    events.items[events.count].x = x;
+    events.items[events.count].y = y;
+    events.count++;
+}
+
+void StepSimulation(GameWorld& world, const InputState& input, float dt, GameEvents& events)
+{
+    static const InputState idle = {};
+    StepSimulation(world, input, idle, dt, events);
+}
+
+// Menus only listen to player 1. In co-op both players share player 1's
+// lives, so the partner is brought back whenever player 1 is.
+void StepSimulation(GameWorld& world, const InputState& input, const InputState& partnerInput, float dt,
+    GameEvents& events)
+{
+    GameState& game = world.game;
+
+    if (game.gameState == STATE_MENU) {
+        HandleStartScreenInput(game, world.player, world.enemies, world.bullets, world.boss, world.bossBullets, world.arena, input, events);
+    }
+    else if (game.gameState == STATE_PLAYING || game.gameState == STATE_BOSS_FIGHT) {
+        UpdateGame(game, world.player, world.partner, world.enemies, world.bullets, world.boss, world.bossBullets,
+            world.arena, world.broadphase, input, partnerInput, dt, events);
+    }
+    else if (game.gameState == STATE_GAME_OVER) {
+        HandleGameOverInput(game, world.player, world.enemies, world.bullets, world.boss, world.bossBullets, world.arena, input, events);
+    }
+    else if (game.gameState == STATE_WIN) {
+        HandleWinScreenInput(game, world.player, world.enemies, world.bullets, world.boss, world.bossBullets, world.arena, input, events);
+    }
+
+    if (world.coop && world.player.isAlive && !world.partner.isAlive) {
+        InitPartner(world.partner);
+    }
+}
+
+// ---------------------------------------------------------
+// Frame profiler
+// ---------------------------------------------------------
+Profiler profiler;
+thread_local int profileThread = 1;     // trace "tid" of samples recorded on this thread
+
+const char* const PHASE_NAMES[PHASE_COUNT] = {
+    "frame", "music", "input", "tick", "move", "broadphase",
+    "collisions", "score", "audio", "particles", "draw", "present"
+};
+
+void InitProfiler(bool enabled)
+{
+    profiler.head = 0;
+    for (int i = 0; i < PROFILE_RING_SIZE; i++) {
+        profiler.slots[i].seq.store(0, memory_order_relaxed);
+    }
+    for (int i = 0; i < PROFILE_THREADS; i++) {
+        profiler.frames[i] = 0;
+    }
+    profiler.enabled = enabled;
+    profiler.epoch = chrono::steady_clock::now();
+}
+
+// Returns a timestamp for ProfileLap/ProfileEnd (0 when profiling is off)
+long long ProfileBegin()
+{
+    if (!profiler.enabled) return 0;
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - profiler.epoch).count();
+}
+
+// Records [start, now) under phase and returns now, so back-to-back phases
+// can be timed with one clock read each
+long long ProfileLap(ProfilePhase phase, long long start)
+{
+    if (!profiler.enabled) return 0;
+
+    long long now = ProfileBegin();
+    unsigned int ticket = profiler.head.fetch_add(1, memory_order_relaxed);
+    ProfileSlot& slot = profiler.slots[ticket & (PROFILE_RING_SIZE - 1)];
+    slot.seq.store(0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    slot.startNs.store(start, memory_order_relaxed);
+    slot.endNs.store(now, memory_order_relaxed);
+    slot.frame.store(profiler.frames[profileThread - 1].load(memory_order_relaxed), memory_order_relaxed);
+    slot.phase.store(phase, memory_order_relaxed);
+    slot.thread.store(profileThread, memory_order_relaxed);
+    slot.seq.store(ticket + 1, memory_order_release);
+    return now;
+}
+
+void ProfileEnd(ProfilePhase phase, long long start)
+{
+    ProfileLap(phase, start);
+}
+
+// Advances the calling thread's frame counter: once per render frame on the
+// render thread, once per tick on the simulation thread.
+void ProfileNextFrame()
+{
+    profiler.frames[profileThread - 1].fetch_add(1, memory_order_relaxed);
+}
+
+// Copies out the sample recorded under ticket. Returns false if it is still
+// being written or has already been overwritten by a later one.
+bool ReadProfileSample(unsigned int ticket, ProfileSample& sample)
+{
+    const ProfileSlot& slot = profiler.slots[ticket & (PROFILE_RING_SIZE - 1)];
+    if (slot.seq.load(memory_order_acquire) != ticket + 1) return false;
+
+    sample.startNs = slot.startNs.load(memory_order_relaxed);
+    sample.endNs = slot.endNs.load(memory_order_relaxed);
+    sample.frame = slot.frame.load(memory_order_relaxed);
+    sample.phase = slot.phase.load(memory_order_relaxed);
+    sample.thread = slot.thread.load(memory_order_relaxed);
+    atomic_thread_fence(memory_order_acquire);
+    return slot.seq.load(memory_order_relaxed) == ticket + 1;
+}
+
+// Sums each phase per frame over the last PROFILE_WINDOW_FRAMES completed
+// frames, then takes min / average / 99th percentile of those totals. Phases
+// recorded on the simulation thread are summed per tick instead.
+void ComputePhaseStats(PhaseStats stats[PHASE_COUNT])
+{
+    static double totals[PHASE_COUNT][PROFILE_WINDOW_FRAMES];
+    memset(totals, 0, sizeof(totals));
+
+    unsigned int current[PROFILE_THREADS];
+    int frames[PROFILE_THREADS];
+    bool done[PROFILE_THREADS];
+    for (int i = 0; i < PROFILE_THREADS; i++) {
+        current[i] = profiler.frames[i].load(memory_order_relaxed);
+        frames[i] = current[i] < (unsigned int)PROFILE_WINDOW_FRAMES ? (int)current[i] : PROFILE_WINDOW_FRAMES;
+        done[i] = current[i] == 0;
+    }
+    int phaseThread[PHASE_COUNT] = { 0 };
+
+    unsigned int head = profiler.head.load(memory_order_acquire);
+    unsigned int available = head < (unsigned int)PROFILE_RING_SIZE ? head : PROFILE_RING_SIZE;
+
+    // Walk back until every thread's samples are older than its window
+    for (unsigned int k = 1; k <= available; k++) {
+        ProfileSample sample;
+        if (!ReadProfileSample(head - k, sample)) continue;
+
+        int th = sample.thread - 1;
+        if (sample.frame >= current[th]) continue;
+        if (current[th] - sample.frame > (unsigned int)frames[th]) {
+            done[th] = true;
+            if (done[0] && done[1]) break;
+            continue;
+        }
+        phaseThread[sample.phase] = th;
+        totals[sample.phase][sample.frame % PROFILE_WINDOW_FRAMES] += (sample.endNs - sample.startNs) * 1e-6;
+    }
+
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        int th = phaseThread[p];
+        int count = frames[th];
+        double values[PROFILE_WINDOW_FRAMES];
+        double sum = 0.0;
+        for (int f = 0; f < count; f++) {
+            values[f] = totals[p][(current[th] - 1 - f) % PROFILE_WINDOW_FRAMES];
+            sum += values[f];
+        }
+        sort(values, values + count);
+
+        stats[p].minMs = count > 0 ? values[0] : 0.0;
+        stats[p].avgMs = count > 0 ? sum / count : 0.0;
+        stats[p].p99Ms = count > 0 ? values[(count * 99 + 99) / 100 - 1] : 0.0;
+    }
+}
+
+void DrawProfilerOverlay()
+{
+    PhaseStats stats[PHASE_COUNT];
+    ComputePhaseStats(stats);
+
+    int x = SCREEN_WIDTH - 270;
+    int y = 70;
+    DrawRectangle(x - 8, y - 6, 270, 22 + PHASE_COUNT * 16, { 0, 0, 0, 180 });
+    DrawText("phase         min    avg    p99 (ms)", x, y, 14, LIME);
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        y += 16;
+        DrawText(PHASE_NAMES[p], x, y, 14, LIGHTGRAY);
+        DrawText(TextFormat("%6.2f %6.2f %6.2f", stats[p].minMs, stats[p].avgMs, stats[p].p99Ms),
+            x + 90, y, 14, LIGHTGRAY);
+    }
+}
+
+// Dumps the ring buffer as complete ("X") events in the Chrome trace event
+// format; open it in chrome://tracing or Perfetto. Samples from the
+// simulation thread carry their tick index rather than a render frame.
+bool WriteChromeTrace(const char* path)
+{
+    ofstream out(path);
+    if (!out) {
+        cout << "could not write trace to " << path << '\n';
+        return false;
+    }
+
+    unsigned int head = profiler.head.load(memory_order_acquire);
+    unsigned int available = head < (unsigned int)PROFILE_RING_SIZE ? head : PROFILE_RING_SIZE;
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    out.setf(ios::fixed);
+    out.precision(3);
+    unsigned int written = 0;
+    for (unsigned int k = available; k >= 1; k--) {
+        ProfileSample sample;
+        if (!ReadProfileSample(head - k, sample)) continue;
+        out << (written > 0 ? ",\n" : "")
+            << "{\"name\":\"" << PHASE_NAMES[sample.phase]
+            << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << sample.thread
+            << ",\"ts\":" << sample.startNs / 1000.0
+            << ",\"dur\":" << (sample.endNs - sample.startNs) / 1000.0
+            << ",\"args\":{\"" << (sample.thread == 2 ? "tick" : "frame") << "\":" << sample.frame << "}}";
+        written++;
+    }
+    out << "\n]}\n";
+
+    cout << "wrote " << written << " profile samples to " << path << '\n';
+    return true;
+}
+
+// ---------------------------------------------------------
+// Frontend: keyboard, audio and main game loop
+// ---------------------------------------------------------
+void PollInput(InputState& input)
+{
+    input.left = IsKeyDown(KEY_LEFT);
+    input.right = IsKeyDown(KEY_RIGHT);
+    input.shoot = input.shoot || IsKeyPressed(KEY_SPACE);
+    input.newGame = input.newGame || IsKeyPressed(KEY_N);
+    input.loadGame = input.loadGame || IsKeyPressed(KEY_L);
+    input.confirm = input.confirm || IsKeyPressed(KEY_ENTER);
+}
+
+// Called once per tick. Identical sounds requested in the same tick play
+// once, so a multi-kill costs one voice rather than one per enemy.
+void PlayGameEvents(const GameEvents& events, GameResources& res, VoicePool& voices)
+{
+    // Indexed from ASSET_FIRST_SOUND; higher may steal a voice from lower
+    const int priorities[ASSET_COUNT - ASSET_FIRST_SOUND] = { 0, 1, 3, 3, 2 };
+    bool requested[ASSET_COUNT] = { false };
+
+    for (int i = 0; i < events.count; i++) {
+        switch (events.items[i].type) {
+        case EVENT_PLAYER_SHOT:
+        case EVENT_BOSS_SHOT:
+            requested[ASSET_SOUND_SHOOT] = true;
+            break;
+        case EVENT_ENEMY_HIT:
+        case EVENT_BOSS_HIT:
+            requested[ASSET_SOUND_EXPLOSION] = true;
+            break;
+        case EVENT_ENEMY_KILLED:
+            break;
+        case EVENT_BOSS_DEFEATED:
+            StopMusicStream(res.gameTheme);
+            requested[ASSET_SOUND_WIN] = true;
+            break;
+        case EVENT_PLAYER_HIT:
+            requested[ASSET_SOUND_PLAYER_HIT] = true;
+            break;
+        case EVENT_GAME_OVER:
+            StopMusicStream(res.gameTheme);
+            requested[ASSET_SOUND_GAME_OVER] = true;
+            break;
+        case EVENT_GAME_RESTARTED:
+            PlayMusicStream(res.gameTheme);
+            break;
+        case EVENT_GAME_LOADED:
+            break;
+        }
+    }
+
+    for (int id = ASSET_FIRST_SOUND; id < ASSET_COUNT; id++) {
+        if (requested[id]) {
+            PlayVoice(voices, res.cache, (AssetId)id, priorities[id - ASSET_FIRST_SOUND]);
+        }
+    }
+}
+
+// Held keys are sampled every frame; presses are latched until a tick has
+// consumed them, so a frame that runs zero ticks does not drop a press and
+// a frame that runs several does not repeat it. The latch itself lives in
+// SimulationLink.pressedInput; this clears the frame's copy once handed over.
+void ConsumePressedInput(InputState& input)
+{
+    input.shoot = false;
+    input.newGame = false;
+    input.loadGame = false;
+    input.confirm = false;
+}
+
+// Hands this frame's keys to the simulation thread
+void SubmitInput(SimulationLink& link, InputState& input)
+{
+    unsigned int bits = PackInput(input);
+    link.heldInput.store(bits & HELD_INPUT_BITS, memory_order_relaxed);
+    link.pressedInput.fetch_or(bits & ~HELD_INPUT_BITS, memory_order_release);
+    ConsumePressedInput(input);
+}
+
+// The simulation runs on its own thread (RunSimulation) and publishes a
+// RenderFrame per tick. This thread owns the window: it polls input, plays
+// the events of new frames and draws the newest frame, so a slow present
+// no longer holds up ticks. The world is only touched again after the
+// simulation thread has been joined.
+void RunGameLoop(GameWorld& world, GameResources& res, const GameConfig& config, ReplaySession& replay,
+    RollbackSession& netplay)
+{
+    InputState input = { 0 };
+    const float tickDt = 1.0f / config.tickRate;
+    static SpriteBatch batch;
+    // One background, player and boss plus every enemy and bullet
+    InitSpriteBatch(batch, 3 + world.enemies.capacity + world.bullets.capacity + world.bossBullets.capacity);
+    static VoicePool voices;
+    InitVoicePool(voices, config.voiceLimit);
+    static ParticleSystem particles;
+    InitParticles(particles, world.game.seed);
+    static RenderCache renderCache;
+    InitRenderCache(renderCache);
+    bool showDebugOverlay = false;
+    bool saveOnExit = false;
+    const char* tracePath = config.tracePath != NULL ? config.tracePath : "trace.json";
+
+    static SimulationLink link;
+    InitFrameExchange(link.exchange, world, netplay, config.maxCatchUpSteps);
+    link.heldInput = 0;
+    link.pressedInput = 0;
+    link.quit = false;
+    thread simulation(RunSimulation, ref(world), cref(config), ref(replay), ref(netplay), ref(link));
+
+    while (!WindowShouldClose())
+    {
+        long long frameStart = ProfileBegin();
+        long long t = frameStart;
+
+        UpdateMusicStream(res.gameTheme);
+        t = ProfileLap(PHASE_MUSIC, t);
+        if (IsKeyPressed(KEY_ESCAPE)) {
+            // Don't overwrite the player's save with a replay's or a co-op game's state
+            saveOnExit = !replay.reader.active && !netplay.active;
+            break;
+        }
+
+        if (IsKeyPressed(KEY_F3)) {
+            showDebugOverlay = !showDebugOverlay;
+        }
+        if (IsKeyPressed(KEY_F4)) {
+            WriteChromeTrace(tracePath);
+        }
+
+        PollInput(input);
+        SubmitInput(link, input);
+        ProfileEnd(PHASE_INPUT, t);
+
+        // Sounds and particles follow the ticks run since the last frame
+        FrameExchange& exchange = link.exchange;
+        if (AcquireRenderFrame(exchange)) {
+            const RenderFrame& fresh = exchange.frames[exchange.front];
+            t = ProfileBegin();
+            PlayGameEvents(fresh.events, res, voices);
+            t = ProfileLap(PHASE_AUDIO, t);
+            SpawnEventParticles(particles, fresh.events, fresh.player);
+            for (int i = 0; i < fresh.ticks; i++) {
+                UpdateParticles(particles, tickDt);
+            }
+            ProfileEnd(PHASE_PARTICLES, t);
+        }
+        const RenderFrame& frame = exchange.frames[exchange.front];
+        const GameState& game = frame.game;
+
+        // How far we are into the tick after the newest one
+        float alpha = (RenderClockNs() - frame.tickTimeNs) * 1e-9f / tickDt;
+        if (alpha < 0.0f) alpha = 0.0f;
+        if (alpha > 1.0f) alpha = 1.0f;
+
+        t = ProfileBegin();
+        BeginDrawing();
+        ClearBackground(BLACK);
+
+        if (game.gameState == STATE_PLAYING || game.gameState == STATE_BOSS_FIGHT) {
+            DrawGame(frame, particles, alpha, res, batch, renderCache);
+            if (showDebugOverlay) {
+                DrawRenderStats(batch, voices, particles, renderCache);
+            }
+            if (showDebugOverlay && frame.netplay) {
+                DrawNetplayStats(frame.netStats, frame.netLead, frame.netDropped);
+            }
+        }
+        else {
+            DrawCachedScreen(renderCache, game);
+        }
+
+        if (showDebugOverlay) {
+            DrawProfilerOverlay();
+        }
+        t = ProfileLap(PHASE_DRAW, t);
+
+        // Includes the vsync / frame limiter wait
+        EndDrawing();
+        ProfileEnd(PHASE_PRESENT, t);
+
+        ProfileEnd(PHASE_FRAME, frameStart);
+        ProfileNextFrame();
+    }
+
+    link.quit.store(true, memory_order_release);
+    simulation.join();
+    if (saveOnExit) {
+        SaveGame(world.game, world.player, world.enemies, world.bullets, world.boss, world.bossBullets);
+    }
+
+    ReleaseVoicePool(voices, res.cache);
+    UnloadRenderCache(renderCache);
+
+    if (config.tracePath != NULL) {
+        WriteChromeTrace(config.tracePath);
+    }
+}
+
+// ---------------------------------------------------------
+// Simulation thread and render frames
+// ---------------------------------------------------------
+long long RenderClockNs()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void InitRenderFrame(RenderFrame& frame, const GameWorld& world, int maxTicks)
+{
+    frame.enemyX.resize(world.enemies.capacity);
+    frame.enemyY.resize(world.enemies.capacity);
+    frame.enemyPrevY.resize(world.enemies.capacity);
+    frame.bulletX.resize(world.bullets.capacity);
+    frame.bulletY.resize(world.bullets.capacity);
+    frame.bulletPrevY.resize(world.bullets.capacity);
+    frame.bossBulletX.resize(world.bossBullets.capacity);
+    frame.bossBulletY.resize(world.bossBullets.capacity);
+    frame.bossBulletPrevX.resize(world.bossBullets.capacity);
+    frame.bossBulletPrevY.resize(world.bossBullets.capacity);
+    frame.events.count = 0;
+    frame.ticks = 0;
+    frame.maxTicks = maxTicks;
+    frame.tickEvents.resize(maxTicks);
+}
+
+// Forgets the sounds and particles of the oldest tick still carried.
+// Music changes are kept and folded into the next tick, since the renderer
+// would otherwise leave the wrong track playing.
+void DropOldestRenderTick(RenderFrame& frame)
+{
+    int oldest = frame.tickEvents[0];
+    int write = 0;
+    for (int i = 0; i < frame.events.count; i++) {
+        GameEventType type = frame.events.items[i].type;
+        bool music = type == EVENT_BOSS_DEFEATED || type == EVENT_GAME_OVER || type == EVENT_GAME_RESTARTED;
+        if (i < oldest && !music) continue;
+        frame.events.items[write++] = frame.events.items[i];
+    }
+
+    int kept = oldest - (frame.events.count - write);
+    frame.events.count = write;
+    for (int t = 1; t < frame.ticks; t++) {
+        frame.tickEvents[t - 1] = frame.tickEvents[t];
+    }
+    frame.ticks--;
+    if (frame.ticks > 0) frame.tickEvents[0] += kept;
+}
+
+// With carry set, frame was never shown and its events are added to
+// rather than replaced. A renderer that has fallen behind only gets the
+// newest maxTicks ticks, the most the loop would ever have caught up on.
+// A tick that did not run (a netplay stall) refreshes the frame without
+// counting.
+void CaptureRenderFrame(RenderFrame& frame, const GameWorld& world, const RollbackSession& netplay,
+    const GameEvents& events, bool carry, bool ticked, long long tickTimeNs)
+{
+    frame.game = world.game;
+    frame.player = world.player;
+    frame.partner = world.partner;
+    frame.boss = world.boss;
+
+    frame.enemyCount = world.enemies.count;
+    memcpy(frame.enemyX.data(), world.enemies.cols.x, sizeof(float) * frame.enemyCount);
+    memcpy(frame.enemyY.data(), world.enemies.cols.y, sizeof(float) * frame.enemyCount);
+    memcpy(frame.enemyPrevY.data(), world.enemies.cols.prevY, sizeof(float) * frame.enemyCount);
+    frame.bulletCount = world.bullets.count;
+    memcpy(frame.bulletX.data(), world.bullets.cols.x, sizeof(float) * frame.bulletCount);
+    memcpy(frame.bulletY.data(), world.bullets.cols.y, sizeof(float) * frame.bulletCount);
+    memcpy(frame.bulletPrevY.data(), world.bullets.cols.prevY, sizeof(float) * frame.bulletCount);
+    frame.bossBulletCount = world.bossBullets.count;
+    memcpy(frame.bossBulletX.data(), world.bossBullets.cols.x, sizeof(float) * frame.bossBulletCount);
+    memcpy(frame.bossBulletY.data(), world.bossBullets.cols.y, sizeof(float) * frame.bossBulletCount);
+    memcpy(frame.bossBulletPrevX.data(), world.bossBullets.cols.prevX, sizeof(float) * frame.bossBulletCount);
+    memcpy(frame.bossBulletPrevY.data(), world.bossBullets.cols.prevY, sizeof(float) * frame.bossBulletCount);
+
+    if (!carry) {
+        frame.events.count = 0;
+        frame.ticks = 0;
+    }
+    if (ticked) {
+        if (frame.ticks == frame.maxTicks) {
+            DropOldestRenderTick(frame);
+        }
+        // Anything not owned by an earlier tick (including music changes
+        // just folded out of a dropped one) is counted as this tick's
+        int earlier = 0;
+        for (int t = 0; t < frame.ticks; t++) {
+            earlier += frame.tickEvents[t];
+        }
+        for (int i = 0; i < events.count; i++) {
+            PushEvent(frame.events, events.items[i].type, events.items[i].x, events.items[i].y);
+        }
+        frame.tickEvents[frame.ticks++] = frame.events.count - earlier;
+    }
+    frame.tickTimeNs = tickTimeNs;
+
+    frame.netplay = netplay.active;
+    if (netplay.active) {
+        frame.netStats = netplay.stats;
+        frame.netLead = netplay.frame - 1 - netplay.remoteConfirmed;
+        frame.netDropped = netplay.link.dropped;
+    }
+}
+
+// All three slots start as the current world, so the renderer has a frame
+// to draw before the first tick
+void InitFrameExchange(FrameExchange& exchange, const GameWorld& world, const RollbackSession& netplay,
+    int maxTicks)
+{
+    static const GameEvents none = {};
+    long long now = RenderClockNs();
+    for (int i = 0; i < 3; i++) {
+        InitRenderFrame(exchange.frames[i], world, maxTicks);
+        CaptureRenderFrame(exchange.frames[i], world, netplay, none, false, false, now);
+    }
+    exchange.back = 0;
+    exchange.middle = 1;
+    exchange.front = 2;
+    exchange.carry = false;
+}
+
+// Simulation side: back becomes the fresh middle. If the slot we get back
+// was never taken by the renderer, the next capture must keep its events.
+void PublishRenderFrame(FrameExchange& exchange)
+{
+    int previous = exchange.middle.exchange(exchange.back | RENDER_FRAME_FRESH, memory_order_acq_rel);
+    exchange.back = previous & ~RENDER_FRAME_FRESH;
+    exchange.carry = (previous & RENDER_FRAME_FRESH) != 0;
+}
+
+// Render side: takes middle as front if it is fresh. Returns whether it was.
+bool AcquireRenderFrame(FrameExchange& exchange)
+{
+    if ((exchange.middle.load(memory_order_relaxed) & RENDER_FRAME_FRESH) == 0) return false;
+
+    int previous = exchange.middle.exchange(exchange.front, memory_order_acq_rel);
+    exchange.front = previous & ~RENDER_FRAME_FRESH;
+    return true;
+}
+
+// Runs ticks at config.tickRate against the wall clock until link.quit,
+// publishing a frame after each. After a long hitch the backlog beyond
+// maxCatchUpSteps is dropped instead of fast-forwarded.
+void RunSimulation(GameWorld& world, const GameConfig& config, ReplaySession& replay, RollbackSession& netplay,
+    SimulationLink& link)
+{
+    profileThread = 2;
+    InputState input = { 0 };
+    GameEvents events;
+    const float tickDt = 1.0f / config.tickRate;
+    const chrono::nanoseconds tickDuration(1000000000LL / config.tickRate);
+    FrameExchange& exchange = link.exchange;
+    auto nextTick = chrono::steady_clock::now() + tickDuration;
+    long long lastTickNs = RenderClockNs();
+
+    while (!link.quit.load(memory_order_acquire)) {
+        auto now = chrono::steady_clock::now();
+        if (now < nextTick) {
+            this_thread::sleep_until(nextTick);
+            continue;
+        }
+        if (now - nextTick > tickDuration * config.maxCatchUpSteps) {
+            nextTick = now;
+        }
+
+        while (nextTick <= now) {
+            unsigned int pressed = link.pressedInput.exchange(0, memory_order_acquire);
+            UnpackInput((unsigned char)(link.heldInput.load(memory_order_relaxed) | pressed), input);
+
+            // The overlay's per-frame counters restart once the renderer
+            // has taken everything published so far
+            if (!exchange.carry) {
+                netplay.stats.frameResimulatedTicks = 0;
+                netplay.stats.frameResimulateMs = 0.0;
+            }
+
+            events.count = 0;
+            ReplayBeforeTick(replay, input);
+            long long t = ProfileBegin();
+            // A stalled netplay tick keeps its key presses for the next one
+            bool ticked = true;
+            if (netplay.active) {
+                ticked = AdvanceRollback(netplay, world, input, tickDt, events);
+                if (!ticked) {
+                    link.pressedInput.fetch_or(pressed, memory_order_relaxed);
+                }
+            }
+            else {
+                StepSimulation(world, input, tickDt, events);
+            }
+            ProfileEnd(PHASE_TICK, t);
+            ProfileNextFrame();
+            ReplayAfterTick(replay, world, events);
+
+            if (ticked) lastTickNs = RenderClockNs();
+            CaptureRenderFrame(exchange.frames[exchange.back], world, netplay, events, exchange.carry,
+                ticked, lastTickNs);
+            PublishRenderFrame(exchange);
+            nextTick += tickDuration;
+        }
+    }
+}
+
+// F3 overlay: the sprite pass should stay at one draw call per non-empty
+// layer and one flush no matter how many entities are on screen.
+void DrawRenderStats(const SpriteBatch& batch, const VoicePool& voices, const ParticleSystem& particles,
+    const RenderCache& cache)
+{
+    DrawText(TextFormat("sprites: %d  draw calls: %d  flushes: %d  text bakes: %lld",
+        batch.count, batch.drawCalls, batch.batchFlushes, cache.bakes),
+        10, SCREEN_HEIGHT - 25, 18, LIME);
+    DrawText(TextFormat("voices: %d / %d  stolen: %d  dropped: %d",
+        CountPlayingVoices(voices), voices.limit, voices.steals, voices.drops),
+        10, SCREEN_HEIGHT - 47, 18, LIME);
+    DrawText(TextFormat("particles: %d / %d  dropped: %lld",
+        particles.count, MAX_PARTICLES, particles.drops),
+        10, SCREEN_HEIGHT - 69, 18, LIME);
+}
+
+// ---------------------------------------------------------
+// Input replays
+// ---------------------------------------------------------
+unsigned int BuildHash()
+{
+    const char* id = SPACE_BUILD_ID;
+    unsigned int hash = 2166136261u;
+    for (; *id != '\0'; id++) {
+        hash = (hash ^ (unsigned char)*id) * 16777619u;
+    }
+    return hash;
+}
+
+unsigned char PackInput(const InputState& input)
+{
+    return (unsigned char)(input.left
+        | input.right << 1
+        | input.shoot << 2
+        | input.newGame << 3
+        | input.loadGame << 4
+        | input.confirm << 5);
+}
+
+void UnpackInput(unsigned char bits, InputState& input)
+{
+    input.left = (bits & 1) != 0;
+    input.right = (bits & 2) != 0;
+    input.shoot = (bits & 4) != 0;
+    input.newGame = (bits & 8) != 0;
+    input.loadGame = (bits & 16) != 0;
+    input.confirm = (bits & 32) != 0;
+}
+
+// LEB128: 7 bits per byte, high bit set on every byte but the last
+void PutVarint(ofstream& file, unsigned long long value)
+{
+    while (value >= 0x80) {
+        file.put((char)(value | 0x80));
+        value >>= 7;
+    }
+    file.put((char)value);
+}
+
+bool GetVarint(ifstream& file, unsigned long long& value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = file.get();
+        if (c == EOF) return false;
+        value |= (unsigned long long)(c & 0x7F) << shift;
+        if ((c & 0x80) == 0) return true;
+    }
+    return false;
+}
+
+bool OpenReplayWriter(ReplayWriter& writer, const char* path, unsigned int seed, int tickRate,
+    const EntityCapacities& capacities)
+{
+    writer.file.open(path, ios::binary);
+    writer.active = writer.file.is_open();
+    writer.runValue = -1;
+    writer.runLength = 0;
+    if (!writer.active) return false;
+
+    unsigned int header[8] = { REPLAY_MAGIC, REPLAY_VERSION, seed, (unsigned int)tickRate, BuildHash(),
+        (unsigned int)capacities.enemies, (unsigned int)capacities.bullets, (unsigned int)capacities.bossBullets };
+    writer.file.write((const char*)header, sizeof(header));
+    return true;
+}
+
+void FlushReplayRun(ReplayWriter& writer)
+{
+    if (writer.runLength == 0) return;
+
+    writer.file.put((char)writer.runValue);
+    PutVarint(writer.file, writer.runLength);
+    writer.runLength = 0;
+}
+
+// Identical consecutive inputs only grow the open run; a record is written
+// (and streamed out through the file buffer) when the input changes.
+void RecordReplayTick(ReplayWriter& writer, const InputState& input)
+{
+    int value = PackInput(input);
+    if (value != writer.runValue) {
+        FlushReplayRun(writer);
+        writer.runValue = value;
+    }
+    writer.runLength++;
+}
+
+// Loading a save brings in state from outside the replay, so the state after
+// that tick (RNG streams included) is embedded in the replay.
+void RecordReplaySnapshot(ReplayWriter& writer, const GameWorld& world)
+{
+    static vector<unsigned char> buffer;
+    buffer.resize(SnapshotMaxBytes(world.enemies, world.bullets, world.bossBullets));
+    int size = SerializeSnapshot(world.game, world.player, world.enemies, world.bullets,
+        world.boss, world.bossBullets, buffer.data(), (int)buffer.size());
+
+    FlushReplayRun(writer);
+    writer.runValue = -1;
+
+    writer.file.put((char)REPLAY_SNAPSHOT_MARKER);
+    PutVarint(writer.file, (unsigned long long)size);
+    writer.file.write((const char*)buffer.data(), size);
+}
+
+void CloseReplayWriter(ReplayWriter& writer)
+{
+    if (!writer.active) return;
+
+    FlushReplayRun(writer);
+    writer.file.close();
+    writer.active = false;
+}
+
+bool OpenReplayReader(ReplayReader& reader, const char* path)
+{
+    reader.file.open(path, ios::binary);
+    reader.active = false;
+    if (!reader.file.is_open()) return false;
+
+    unsigned int header[8];
+    reader.file.read((char*)header, sizeof(header));
+    if (reader.file.gcount() != (streamsize)sizeof(header)) return false;
+    if (header[0] != REPLAY_MAGIC || header[1] != REPLAY_VERSION) return false;
+
+    reader.seed = header[2];
+    reader.tickRate = (int)header[3];
+    reader.buildHash = header[4];
+    reader.capacities.enemies = (int)header[5];
+    reader.capacities.bullets = (int)header[6];
+    reader.capacities.bossBullets = (int)header[7];
+    if (reader.tickRate < 1) return false;
+    if (ClampCapacity(reader.capacities.enemies) != reader.capacities.enemies
+        || ClampCapacity(reader.capacities.bullets) != reader.capacities.bullets
+        || ClampCapacity(reader.capacities.bossBullets) != reader.capacities.bossBullets) return false;
+
+    if (reader.buildHash != BuildHash()) {
+        cout << "warning: replay was recorded by a different build and may not reproduce\n";
+    }
+
+    reader.active = true;
+    return ReadReplayRun(reader, NULL);
+}
+
+// Reads up to the next input run, applying any snapshot chunks on the way.
+// Clears reader.active at the end of the file or on a bad record.
+bool ReadReplayRun(ReplayReader& reader, GameWorld* world)
+{
+    static vector<unsigned char> buffer;
+
+    for (;;) {
+        int c = reader.file.get();
+        if (c == EOF) break;
+
+        if (c == REPLAY_SNAPSHOT_MARKER) {
+            unsigned long long size = 0;
+            if (world == NULL || !GetVarint(reader.file, size)) break;
+            if (size > (unsigned long long)SnapshotMaxBytes(world->enemies, world->bullets, world->bossBullets)) break;
+
+            buffer.resize((size_t)size);
+            reader.file.read((char*)buffer.data(), (streamsize)size);
+            if (reader.file.gcount() != (streamsize)size) break;
+            if (!DeserializeSnapshot(buffer.data(), (int)size, world->game, world->player, world->enemies,
+                world->bullets, world->boss, world->bossBullets)) break;
+            continue;
+        }
+
+        unsigned long long length = 0;
+        if (!GetVarint(reader.file, length) || length == 0) break;
+
+        reader.runValue = c;
+        reader.runLeft = length;
+        return true;
+    }
+
+    reader.active = false;
+    return false;
+}
+
+// Playback replaces this tick's input; recording stores the final input.
+void ReplayBeforeTick(ReplaySession& replay, InputState& input)
+{
+    if (replay.reader.active) {
+        UnpackInput((unsigned char)replay.reader.runValue, input);
+    }
+    if (replay.writer.active) {
+        RecordReplayTick(replay.writer, input);
+    }
+}
+
+void ReplayAfterTick(ReplaySession& replay, GameWorld& world, const GameEvents& events)
+{
+    if (replay.reader.active && --replay.reader.runLeft == 0) {
+        if (!ReadReplayRun(replay.reader, &world)) {
+            cout << "replay finished\n";
+        }
+    }
+
+    if (replay.writer.active) {
+        for (int i = 0; i < events.count; i++) {
+            if (events.items[i].type == EVENT_GAME_LOADED) {
+                RecordReplaySnapshot(replay.writer, world);
+                break;
+            }
+        }
+    }
+}
+
+// ---------------------------------------------------------
+// Netplay (rollback over UDP)
+// ---------------------------------------------------------
+long long NetClockMs()
+{
+    return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// "host:port", or a bare port on 127.0.0.1
+bool ParseNetAddress(const char* text, sockaddr_in& address)
+{
+    char host[64] = "127.0.0.1";
+    const char* colon = strrchr(text, ':');
+    const char* port = text;
+    if (colon != NULL) {
+        if (colon - text >= (int)sizeof(host)) return false;
+        memcpy(host, text, colon - text);
+        host[colon - text] = '\0';
+        port = colon + 1;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons((unsigned short)atoi(port));
+    return atoi(port) > 0 && inet_pton(AF_INET, host, &address.sin_addr) == 1;
+}
+
+// Binds localPort and connects to peer, so only the peer's packets arrive.
+// The socket never blocks.
+bool OpenNetLink(NetLink& link, int localPort, const char* peer, const GameConfig& config)
+{
+    link.open = false;
+    link.delayMs = config.netDelayMs;
+    link.jitterMs = config.netJitterMs;
+    link.lossPercent = config.netLossPercent;
+    RngSeed(link.rng, NewRandomSeed(), RNG_STREAM_COUNT + 1);
+    link.pendingCount = 0;
+    link.sent = 0;
+    link.dropped = 0;
+    link.received = 0;
+
+    sockaddr_in remote;
+    if (!ParseNetAddress(peer, remote)) return false;
+
+#if defined(_WIN32)
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) return false;
+    link.socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (link.socket == INVALID_SOCKET) return false;
+    u_long nonBlocking = 1;
+    ioctlsocket(link.socket, FIONBIO, &nonBlocking);
+#else
+    link.socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (link.socket < 0) return false;
+    fcntl(link.socket, F_SETFL, fcntl(link.socket, F_GETFL, 0) | O_NONBLOCK);
+#endif
+
+    sockaddr_in local;
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = htons((unsigned short)localPort);
+    link.open = bind(link.socket, (const sockaddr*)&local, sizeof(local)) == 0
+        && connect(link.socket, (const sockaddr*)&remote, sizeof(remote)) == 0;
+    if (!link.open) CloseNetLink(link);
+    return link.open;
+}
+
+void CloseNetLink(NetLink& link)
+{
+#if defined(_WIN32)
+    closesocket(link.socket);
+    WSACleanup();
+#else
+    close(link.socket);
+#endif
+    link.open = false;
+}
+
+// Applies the artificial loss, then either sends straight away or holds
+// the packet back for its delay plus jitter. Jitter can reorder packets.
+void SendNetPacket(NetLink& link, const unsigned char* data, int size)
+{
+    if (link.lossPercent > 0 && RngRange(link.rng, 0, 99) < link.lossPercent) {
+        link.dropped++;
+        return;
+    }
 
-// Game initialization
-void InitPlayer(Player& player);
-void InitBullets(Bullet bullets[], int maxBullets);
-void InitBoss(Boss& boss);
-void InitBossBullets(Bullet bossBullets[], int maxBossBullets);
-bool OverlapsAnyPreviousEnemy(const Enemy enemies[], int countSoFar, float x, float y, int w, int h);
-void InitEnemiesForLevel(const GameState& game, Enemy enemies[], int& enemyCount);
-void InitGame(GameState& game, Player& player, Enemy enemies[], int& enemyCount, Bullet bullets[], int maxBullets, Boss& boss, Bullet bossBullets[], int maxBossBullets);
+    if (link.delayMs == 0 && link.jitterMs == 0) {
+        send(link.socket, (const char*)data, size, 0);
+        link.sent++;
+        return;
+    }
 
-// Main game loop
-void RunGameLoop(GameState& game, Player& player, Enemy enemies[], int& enemyCount, Bullet bullets[], int maxBullets, Boss& boss, Bullet bossBullets[], int maxBossBullets, const GameResources& res);
+    if (link.pendingCount == NET_MAX_PENDING) {
+        link.dropped++;
+        return;
+    }
+    NetPacket& packet = link.pending[link.pendingCount++];
+    packet.sendAt = NetClockMs() + link.delayMs + (link.jitterMs > 0 ? RngRange(link.rng, 0, link.jitterMs) : 0);
+    packet.size = size;
+    memcpy(packet.data, data, size);
+}
 
-// Screens: Start / Game Over / Win
-void DrawStartScreen(const GameState& game);
-void HandleStartScreenInput(GameState& game, Player& player, Enemy enemies[], int& enemyCount, Bullet bullets[], int maxBullets, Boss& boss, Bullet bossBullets[], int maxBossBullets);
-void DrawGameOverScreen(const GameState& game);
-void HandleGameOverInput(GameState& game, Player& player, Enemy enemies[], int& enemyCount, Bullet bullets[], int maxBullets, Boss& boss, Bullet bossBullets[], int maxBossBullets, const GameResources& res);
-void DrawWinScreen(const GameState& game);
-void HandleWinScreenInput(GameState& game, Player& player, Enemy enemies[], int& enemyCount, Bullet bullets[], int maxBullets, Boss& boss, Bullet bossBullets[], int maxBossBullets, const GameResources& res);
+// Sends every held-back packet whose time has come
+void FlushNetLink(NetLink& link)
+{
+    long long now = NetClockMs();
+    int i = 0;
+    while (i < link.pendingCount) {
+        NetPacket& packet = link.pending[i];
+        if (packet.sendAt > now) {
+            i++;
+            continue;
+        }
+        send(link.socket, (const char*)packet.data, packet.size, 0);
+        link.sent++;
+        packet = link.pending[--link.pendingCount];
+    }
+}
 
-// Game update & drawing (PLAYING/BOSS state)
-void UpdateGame(GameState& game, Player& player, Enemy enemies[], int& enemyCount, Bullet bullets[], int maxBullets, Boss& boss, Bullet bossBullets[], int maxBossBullets, const GameResources& res);
-void DrawGame(const GameState& game, const Player& player, const Enemy enemies[], int enemyCount, const Bullet bullets[], int maxBullets, const Boss& boss, const Bullet bossBullets[], int maxBossBullets, const GameResources& res);
+// Returns the packet size, or 0 when nothing is waiting. Errors (such as
+// the peer's port not being open yet) also read as "nothing waiting".
+int ReceiveNetPacket(NetLink& link, unsigned char* out, int capacity)
+{
+    int size = (int)recv(link.socket, (char*)out, capacity, 0);
+    if (size <= 0) return 0;
 
-// Player movement + shooting
-void UpdatePlayer(Player& player);
-void HandlePlayerShooting(const Player& player, Bullet bullets[], int maxBullets, const GameResources& res);
+    link.received++;
+    return size;
+}
 
-// Bullets & Enemies & Boss
-void UpdateBullets(Bullet bullets[], int maxBullets);
-void UpdateEnemies(Enemy enemies[], int enemyCount);
-void UpdateBoss(Boss& boss);
-void HandleBossShooting(Boss& boss, Bullet bossBullets[], int maxBossBullets, const GameResources& res);
-void UpdateBossBullets(Bullet bossBullets[], int maxBossBullets);
+size_t WorldStateBytes(const GameWorld& world)
+{
+    return sizeof(float) * (5 * (size_t)world.enemies.capacity + 3 * (size_t)world.bullets.capacity
+        + 6 * (size_t)world.bossBullets.capacity);
+}
 
-// Collisions & lives
-bool RectanglesOverlap(float x1, float y1, int w1, int h1, float x2, float y2, int w2, int h2);
-void CheckBulletEnemyCollisions(Bullet bullets[], int maxBullets, Enemy enemies[], int enemyCount, GameState& game, const GameResources& res);
-bool CheckEnemyPlayerCollisions(const Enemy enemies[], int enemyCount, const Player& player);
-void CheckBulletBossCollisions(Bullet bullets[], int maxBullets, Boss& boss, GameState& game, const GameResources& res);
-bool CheckBossPlayerCollision(const Boss& boss, const Player& player);
-bool CheckBossBulletPlayerCollisions(const Bullet bossBullets[], int maxBossBullets, const Player& player);
-void HandlePlayerHit(GameState& game, Player& player, Enemy enemies[], int& enemyCount, Bullet bullets[], int maxBullets, Boss& boss, Bullet bossBullets[], int maxBossBullets, const GameResources& res);
+template <typename T>
+void SaveColumn(unsigned char*& p, const T* column, int count)
+{
+    memcpy(p, column, sizeof(T) * count);
+    p += sizeof(T) * count;
+}
 
-// HUD, scoring, level progression
-void DrawHUD(const GameState& game, const Player& player, const Boss& boss);
-void UpdateScoreAndLevel(GameState& game, Player& player, Enemy enemies[], int& enemyCount, Bullet bullets[], int maxBullets, Boss& boss, Bullet bossBullets[], int maxBossBullets, const GameResources& res);
-void ResetLevel(GameState& game, Player& player, Enemy enemies[], int& enemyCount, Bullet bullets[], int maxBullets, Boss& boss, Bullet bossBullets[], int maxBossBullets);
-void ResetGameToLevel1(GameState& game, Player& player, Enemy enemies[], int& enemyCount, Bullet bullets[], int maxBullets, Boss& boss, Bullet bossBullets[], int maxBossBullets);
-bool AreAllEnemiesDestroyed(const Enemy enemies[], int enemyCount);
+template <typename T>
+void LoadColumn(const unsigned char*& p, T* column, int count)
+{
+    memcpy(column, p, sizeof(T) * count);
+    p += sizeof(T) * count;
+}
 
-// Save/Load
-void SaveGame(const GameState& game, const Player& player, const Boss& boss);
-void LoadGame(GameState& game, Player& player, Boss& boss);
+void SaveWorldState(WorldState& state, const GameWorld& world)
+{
+    state.game = world.game;
+    state.player = world.player;
+    state.partner = world.partner;
+    state.boss = world.boss;
+    state.enemyCount = world.enemies.count;
+    state.bulletCount = world.bullets.count;
+    state.bossBulletCount = world.bossBullets.count;
+
+    unsigned char* p = state.columns.data();
+    const EnemyColumns& e = world.enemies.cols;
+    SaveColumn(p, e.x, state.enemyCount);
+    SaveColumn(p, e.y, state.enemyCount);
+    SaveColumn(p, e.prevY, state.enemyCount);
+    SaveColumn(p, e.speed, state.enemyCount);
+    SaveColumn(p, e.health, state.enemyCount);
+    const BulletColumns& b = world.bullets.cols;
+    SaveColumn(p, b.x, state.bulletCount);
+    SaveColumn(p, b.y, state.bulletCount);
+    SaveColumn(p, b.prevY, state.bulletCount);
+    const BossBulletColumns& bb = world.bossBullets.cols;
+    SaveColumn(p, bb.x, state.bossBulletCount);
+    SaveColumn(p, bb.y, state.bossBulletCount);
+    SaveColumn(p, bb.prevX, state.bossBulletCount);
+    SaveColumn(p, bb.prevY, state.bossBulletCount);
+    SaveColumn(p, bb.vx, state.bossBulletCount);
+    SaveColumn(p, bb.vy, state.bossBulletCount);
+}
 
+// Pools are refilled in order, so dense indices match the saved ones
+void LoadWorldState(GameWorld& world, const WorldState& state)
+{
+    world.game = state.game;
+    world.player = state.player;
+    world.partner = state.partner;
+    world.boss = state.boss;
+
+    PoolClear(world.enemies);
+    for (int i = 0; i < state.enemyCount; i++) PoolAcquire(world.enemies);
+    PoolClear(world.bullets);
+    for (int i = 0; i < state.bulletCount; i++) PoolAcquire(world.bullets);
+    PoolClear(world.bossBullets);
+    for (int i = 0; i < state.bossBulletCount; i++) PoolAcquire(world.bossBullets);
+
+    const unsigned char* p = state.columns.data();
+    EnemyColumns& e = world.enemies.cols;
+    LoadColumn(p, e.x, state.enemyCount);
+    LoadColumn(p, e.y, state.enemyCount);
+    LoadColumn(p, e.prevY, state.enemyCount);
+    LoadColumn(p, e.speed, state.enemyCount);
+    LoadColumn(p, e.health, state.enemyCount);
+    BulletColumns& b = world.bullets.cols;
+    LoadColumn(p, b.x, state.bulletCount);
+    LoadColumn(p, b.y, state.bulletCount);
+    LoadColumn(p, b.prevY, state.bulletCount);
+    BossBulletColumns& bb = world.bossBullets.cols;
+    LoadColumn(p, bb.x, state.bossBulletCount);
+    LoadColumn(p, bb.y, state.bossBulletCount);
+    LoadColumn(p, bb.prevX, state.bossBulletCount);
+    LoadColumn(p, bb.prevY, state.bossBulletCount);
+    LoadColumn(p, bb.vx, state.bossBulletCount);
+    LoadColumn(p, bb.vy, state.bossBulletCount);
+}
 
-// ---------------------------------------------------------
-// MAIN FUNCTION 
-// ---------------------------------------------------------
-int main()
+// Opens the link and trades hellos until the peer answers. Player 2 takes
+// player 1's seed, tick rate and capacities; both sides refuse a peer
+// built from different code, which could never stay in sync.
+bool ConnectNetplay(RollbackSession& session, GameConfig& config, unsigned int& seed)
 {
-    GameResources resources = { 0 };
-    InitWindowAndResources(resources);
-    PlayMusicStream(resources.gameTheme);
-    SetMusicVolume(resources.gameTheme, 0.2f);
+    int other = 3 - config.netPlayer;
+    int localPort = config.netPort > 0 ? config.netPort : NET_BASE_PORT + config.netPlayer;
+    char defaultPeer[16];
+    snprintf(defaultPeer, sizeof(defaultPeer), "%d", NET_BASE_PORT + other);
+    const char* peer = config.netPeer != NULL ? config.netPeer : defaultPeer;
+
+    NetLink& link = session.link;
+    if (!OpenNetLink(link, localPort, peer, config)) {
+        cout << "netplay: could not open UDP port " << localPort << " to " << peer << '\n';
+        return false;
+    }
+    cout << "netplay: player " << config.netPlayer << " on port " << localPort << ", waiting for " << peer << '\n';
+
+    // Each hello says whether we have heard the peer's yet. Player 1 is
+    // connected once player 2 has its hello (or is already sending
+    // inputs); player 2 once it has player 1's settings.
+    bool heardHello = false;
+    bool connected = false;
+    long long start = NetClockMs();
+    long long nextHello = 0;
+    while (!connected) {
+        long long now = NetClockMs();
+        if (now - start > NET_CONNECT_TIMEOUT_MS) {
+            cout << "netplay: no answer from " << peer << '\n';
+            CloseNetLink(link);
+            return false;
+        }
 
-    GameState game;
-    Player player;
-    Enemy enemies[MAX_ENEMIES];
-    Bullet bullets[MAX_BULLETS];
-    Boss boss;
-    Bullet bossBullets[MAX_BOSS_BULLETS];
-    int enemyCount = 0;
+        if (now >= nextHello) {
+            unsigned char hello[NET_MAX_PACKET];
+            unsigned char* p = hello;
+            PutSnapshotInt(p, (int)NET_MAGIC);
+            PutSnapshotInt(p, NET_HELLO);
+            PutSnapshotInt(p, (int)seed);
+            PutSnapshotInt(p, config.tickRate);
+            PutSnapshotInt(p, config.capacities.enemies);
+            PutSnapshotInt(p, config.capacities.bullets);
+            PutSnapshotInt(p, config.capacities.bossBullets);
+            PutSnapshotInt(p, (int)BuildHash());
+            PutSnapshotInt(p, heardHello ? 1 : 0);
+            SendNetPacket(link, hello, (int)(p - hello));
+            nextHello = now + 100;
+        }
+        FlushNetLink(link);
+
+        unsigned char packet[NET_MAX_PACKET];
+        int size;
+        while ((size = ReceiveNetPacket(link, packet, sizeof(packet))) >= 8) {
+            const unsigned char* p = packet;
+            if ((unsigned int)GetSnapshotInt(p) != NET_MAGIC) continue;
+            int kind = GetSnapshotInt(p);
+            if (kind == NET_INPUTS) {
+                connected = connected || config.netPlayer == 1;
+                continue;
+            }
+            if (kind != NET_HELLO || size < 36) continue;
+
+            unsigned int peerSeed = (unsigned int)GetSnapshotInt(p);
+            int peerTickRate = GetSnapshotInt(p);
+            EntityCapacities peerCapacities;
+            peerCapacities.enemies = GetSnapshotInt(p);
+            peerCapacities.bullets = GetSnapshotInt(p);
+            peerCapacities.bossBullets = GetSnapshotInt(p);
+            if ((unsigned int)GetSnapshotInt(p) != BuildHash()) {
+                cout << "netplay: the peer runs a different build\n";
+                CloseNetLink(link);
+                return false;
+            }
+            bool peerHeardUs = GetSnapshotInt(p) != 0;
+
+            if (config.netPlayer == 2 && !heardHello) {
+                seed = peerSeed;
+                config.tickRate = peerTickRate < 1 ? 1 : peerTickRate;
+                config.capacities.enemies = ClampCapacity(peerCapacities.enemies);
+                config.capacities.bullets = ClampCapacity(peerCapacities.bullets);
+                config.capacities.bossBullets = ClampCapacity(peerCapacities.bossBullets);
+            }
+            heardHello = true;
+            connected = connected || config.netPlayer == 2 || peerHeardUs;
+        }
 
-    
-    InitGame(game, player, enemies, enemyCount, bullets, MAX_BULLETS, boss, bossBullets, MAX_BOSS_BULLETS);
-    RunGameLoop(game, player, enemies, enemyCount, bullets, MAX_BULLETS, boss, bossBullets, MAX_BOSS_BULLETS, resources);
+        if (!connected) {
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+    }
 
-    UnloadResourcesAndCloseWindow(resources);
-    return 0;
+    cout << "netplay: connected, seed " << seed << '\n';
+    session.active = true;
+    return true;
 }
 
-// ---------------------------------------------------------
-// Window / resources
-// ---------------------------------------------------------
-void InitWindowAndResources(GameResources& res)
+void InitRollback(RollbackSession& session, const GameWorld& world, int localIndex)
 {
-    InitWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "Space Shooter - PF Project");
-    res.bulletTexture = LoadTexture("bullet.png");
-    res.enemyTexture = LoadTexture("enemy.png");
-    res.playerTexture = LoadTexture("shooter.png");
-    res.backgroundTexture = LoadTexture("background.png");
-    res.bossTexture = LoadTexture("boss.png");
-    res.bossBulletTexture = LoadTexture("bullet.png");
+    session.localIndex = localIndex;
+    session.frame = 0;
+    session.remoteConfirmed = -1;
+    session.remoteAcked = -1;
+    session.rollbackFrom = -1;
+    for (int i = 0; i < NET_INPUT_RING; i++) {
+        session.localInputs[i] = 0;
+        session.remoteInputs[i] = 0;
+        session.remoteFrame[i] = -1;
+        session.predicted[i] = 0;
+    }
+    for (int i = 0; i < ROLLBACK_STATES; i++) {
+        session.states[i].columns.resize(WorldStateBytes(world));
+    }
+    session.stats = {};
+}
 
-    InitAudioDevice();
-    res.shootSound = LoadSound("shoot.wav");
-    res.explodeSound = LoadSound("explosion.wav");
-    res.gameOverSound = LoadSound("gameover.wav");
-    res.winSound = LoadSound("win.wav");
-    res.playerHitSound = LoadSound("hit.wav");
-    res.gameTheme = LoadMusicStream("theme.mp3");
+// The remote input for tick: the real one when it has arrived, otherwise
+// a guess (the last confirmed input with its presses cleared), which is
+// remembered so its arrival can tell whether the guess was wrong
+unsigned char RemoteInputForTick(RollbackSession& session, long long tick)
+{
+    int slot = (int)(tick % NET_INPUT_RING);
+    if (session.remoteFrame[slot] == tick) return session.remoteInputs[slot];
 
-    SetTargetFPS(60);
-    SetExitKey(0);
+    unsigned char last = 0;
+    if (session.remoteConfirmed >= 0) {
+        last = session.remoteInputs[session.remoteConfirmed % NET_INPUT_RING];
+    }
+    session.predicted[slot] = last & HELD_INPUT_BITS;
+    return session.predicted[slot];
 }
 
-void UnloadResourcesAndCloseWindow(GameResources& res)
+void ReceiveRemoteInput(RollbackSession& session, long long tick, unsigned char bits)
 {
-  
-    UnloadTexture(res.bulletTexture);
-    UnloadTexture(res.enemyTexture);
-    UnloadTexture(res.playerTexture);
-    UnloadTexture(res.backgroundTexture);
-    UnloadTexture(res.bossTexture);
-    UnloadTexture(res.bossBulletTexture);
+    if (tick <= session.remoteConfirmed || tick >= session.remoteConfirmed + NET_INPUT_RING) return;
 
+    int slot = (int)(tick % NET_INPUT_RING);
+    if (session.remoteFrame[slot] == tick) return;
 
-    UnloadSound(res.shootSound);
-    UnloadSound(res.explodeSound);
-    UnloadSound(res.gameOverSound);
-    UnloadSound(res.winSound);
-    UnloadSound(res.playerHitSound);
-    UnloadMusicStream(res.gameTheme);
+    // Already simulated on a guess that turned out wrong
+    if (tick < session.frame && session.predicted[slot] != bits
+        && (session.rollbackFrom < 0 || tick < session.rollbackFrom)) {
+        session.rollbackFrom = tick;
+    }
+    session.remoteInputs[slot] = bits;
+    session.remoteFrame[slot] = tick;
 
-    CloseAudioDevice();
-    CloseWindow();
+    while (session.remoteFrame[(session.remoteConfirmed + 1) % NET_INPUT_RING] == session.remoteConfirmed + 1) {
+        session.remoteConfirmed++;
+    }
 }
 
-// ---------------------------------------------------------
-// Game initialization
-// ---------------------------------------------------------
-void InitPlayer(Player& player)
+void PollNetplay(RollbackSession& session)
 {
-    player.width = 60;
-    player.height = 60;
-    player.x = SCREEN_WIDTH / 2.0f - player.width / 2.0f;
-    player.y = SCREEN_HEIGHT - 60.0f;
-    player.speed = 5.0f;
-    player.lives = 3;
-    player.isAlive = true;
+    FlushNetLink(session.link);
+
+    unsigned char packet[NET_MAX_PACKET];
+    int size;
+    while ((size = ReceiveNetPacket(session.link, packet, sizeof(packet))) >= 20) {
+        const unsigned char* p = packet;
+        if ((unsigned int)GetSnapshotInt(p) != NET_MAGIC || GetSnapshotInt(p) != NET_INPUTS) continue;
+
+        long long first = GetSnapshotInt(p);
+        int count = GetSnapshotInt(p);
+        long long ack = GetSnapshotInt(p);
+        if (count < 0 || count > size - 20) continue;
+
+        if (ack > session.remoteAcked) session.remoteAcked = ack;
+        for (int i = 0; i < count; i++) {
+            ReceiveRemoteInput(session, first + i, p[i]);
+        }
+    }
 }
 
-void InitBullets(Bullet bullets[], int maxBullets)
+// Sends every local input the peer hasn't acknowledged, so a lost packet
+// is covered by the next one, plus our own ack
+void SendNetplayInputs(RollbackSession& session)
 {
-    for (int i = 0; i < maxBullets; i++) {
-        bullets[i].active = false;
-        bullets[i].width = 30;
-        bullets[i].height = 30;
-        bullets[i].speed = 8.0f;
-        bullets[i].x = 0;
-        bullets[i].y = 0;
+    long long last = session.frame - 1;
+    long long first = session.remoteAcked + 1;
+    if (last - first + 1 > NET_MAX_PACKET_INPUTS) first = last - NET_MAX_PACKET_INPUTS + 1;
+    int count = last >= first ? (int)(last - first + 1) : 0;
+
+    unsigned char packet[NET_MAX_PACKET];
+    unsigned char* p = packet;
+    PutSnapshotInt(p, (int)NET_MAGIC);
+    PutSnapshotInt(p, NET_INPUTS);
+    PutSnapshotInt(p, (int)first);
+    PutSnapshotInt(p, count);
+    PutSnapshotInt(p, (int)session.remoteConfirmed);
+    for (int i = 0; i < count; i++) {
+        *p++ = session.localInputs[(first + i) % NET_INPUT_RING];
     }
+    SendNetPacket(session.link, packet, (int)(p - packet));
 }
 
-void InitBoss(Boss& boss)
+void SimulateNetTick(RollbackSession& session, GameWorld& world, long long tick, float dt, GameEvents& events)
 {
-    boss.width = BOSS_WIDTH;
-    boss.height = BOSS_HEIGHT;
-    boss.x = SCREEN_WIDTH / 2.0f - boss.width / 2.0f;
-    boss.y = 50.0f;
-    boss.speed = BOSS_SPEED;
-    boss.health = BOSS_INITIAL_HEALTH;
-    boss.active = false;
-    boss.shootTimer = 1.0f;
+    InputState local;
+    InputState remote;
+    UnpackInput(session.localInputs[tick % NET_INPUT_RING], local);
+    UnpackInput(RemoteInputForTick(session, tick), remote);
+
+    if (session.localIndex == 0) {
+        StepSimulation(world, local, remote, dt, events);
+    }
+    else {
+        StepSimulation(world, remote, local, dt, events);
+    }
 }
 
-void InitBossBullets(Bullet bossBullets[], int maxBossBullets)
+// Rewinds to the first tick run on a wrong guess and runs every tick since
+// again with what is known now. Their events were already played once.
+void Resimulate(RollbackSession& session, GameWorld& world, float dt)
 {
-    for (int i = 0; i < maxBossBullets; i++) {
-        bossBullets[i].active = false;
-        bossBullets[i].width = 30;
-        bossBullets[i].height = 30;
-        bossBullets[i].speed = 6.0f;
-        bossBullets[i].x = 0;
-        bossBullets[i].y = 0;
+    long long from = session.rollbackFrom;
+    session.rollbackFrom = -1;
+    if (from < 0) return;
+
+    auto start = chrono::steady_clock::now();
+
+    LoadWorldState(world, session.states[from % ROLLBACK_STATES]);
+    for (long long tick = from; tick < session.frame; tick++) {
+        if (tick > from) {
+            SaveWorldState(session.states[tick % ROLLBACK_STATES], world);
+        }
+        session.scratchEvents.count = 0;
+        SimulateNetTick(session, world, tick, dt, session.scratchEvents);
     }
+
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    int depth = (int)(session.frame - from);
+    RollbackStats& stats = session.stats;
+    stats.rollbacks++;
+    stats.resimulatedTicks += depth;
+    stats.resimulateMs += ms;
+    if (depth > stats.maxDepth) stats.maxDepth = depth;
+    stats.frameResimulatedTicks += depth;
+    stats.frameResimulateMs += ms;
 }
 
-bool OverlapsAnyPreviousEnemy(const Enemy enemies[], int countSoFar,
-    float x, float y, int w, int h)
+// One netplay tick: take in the peer's inputs (rolling back if a guess was
+// wrong), then run the next tick at once with the local input and a guess
+// for the remote one. Local input is never delayed; only when the peer
+// falls ROLLBACK_WINDOW ticks behind does this stall (returns false).
+bool AdvanceRollback(RollbackSession& session, GameWorld& world, const InputState& localInput, float dt,
+    GameEvents& events)
 {
-    for (int i = 0; i < countSoFar; i++) {
-        if (!enemies[i].active) continue;
+    PollNetplay(session);
+    Resimulate(session, world, dt);
 
-        if (RectanglesOverlap(x, y, w, h,
-            enemies[i].x, enemies[i].y,
-            enemies[i].width, enemies[i].height)) {
-            return true;
-        }
+    if (session.frame - session.remoteConfirmed > ROLLBACK_WINDOW) {
+        session.stats.stalls++;
+        SendNetplayInputs(session);
+        return false;
     }
-    return false;
+
+    // Loading a save would bring in state the peer doesn't have
+    InputState local = localInput;
+    local.loadGame = false;
+    session.localInputs[session.frame % NET_INPUT_RING] = PackInput(local);
+
+    SaveWorldState(session.states[session.frame % ROLLBACK_STATES], world);
+    SimulateNetTick(session, world, session.frame, dt, events);
+    session.frame++;
+    session.stats.ticks++;
+
+    SendNetplayInputs(session);
+    return true;
 }
 
-void InitEnemiesForLevel(const GameState& game,
-    Enemy enemies[], int& enemyCount)
+// F3 overlay, above the render stats. The "this frame" counters cover the
+// ticks since the renderer last took a frame.
+void DrawNetplayStats(const RollbackStats& stats, long long lead, long long dropped)
 {
-    int level = game.level;
+    double rate = stats.ticks > 0 ? 100.0 * stats.rollbacks / stats.ticks : 0.0;
+    double depth = stats.rollbacks > 0 ? (double)stats.resimulatedTicks / stats.rollbacks : 0.0;
+    DrawText(TextFormat("rollbacks: %lld (%.1f%% of ticks)  depth avg %.1f max %d  stalls: %lld",
+        stats.rollbacks, rate, depth, stats.maxDepth, stats.stalls),
+        10, SCREEN_HEIGHT - 113, 18, LIME);
+    DrawText(TextFormat("resimulated this frame: %d ticks, %.3f ms  lead: %lld  loss: %lld",
+        stats.frameResimulatedTicks, stats.frameResimulateMs, lead, dropped),
+        10, SCREEN_HEIGHT - 91, 18, LIME);
+}
 
-   
-    enemyCount = 3 + level * 3;
-    if (enemyCount > MAX_ENEMIES) enemyCount = MAX_ENEMIES;
+void PrintNetplayStats(const RollbackSession& session)
+{
+    const RollbackStats& stats = session.stats;
+    cout << "netplay ticks: " << stats.ticks << '\n'
+        << "rollbacks: " << stats.rollbacks << " ("
+        << (stats.ticks > 0 ? 100.0 * stats.rollbacks / stats.ticks : 0.0) << "% of ticks)\n"
+        << "resimulated ticks: " << stats.resimulatedTicks << " (max depth " << stats.maxDepth << ")\n"
+        << "resimulation ms: " << stats.resimulateMs << " total, "
+        << (stats.rollbacks > 0 ? stats.resimulateMs / stats.rollbacks : 0.0) << " per rollback\n"
+        << "stalls: " << stats.stalls << '\n'
+        << "packets sent: " << session.link.sent << ", dropped: " << session.link.dropped
+        << ", received: " << session.link.received << '\n';
+}
 
-    float baseSpeed = 1.0f + level * 0.3f;
+// ---------------------------------------------------------
+// Headless runner
+// ---------------------------------------------------------
 
-    int centerX = SCREEN_WIDTH / 2;
-    int halfRange = 250;
-    int minX = centerX - halfRange;
-    if (minX < 0) minX = 0;
+// Presses ENTER on every menu screen. Returns true while not in play.
+bool BotHandleMenus(const GameWorld& world, InputState& input)
+{
+    if (world.game.gameState == STATE_PLAYING || world.game.gameState == STATE_BOSS_FIGHT) return false;
 
-    int maxX = centerX + halfRange;
-    if (maxX > SCREEN_WIDTH) maxX = SCREEN_WIDTH;
+    input.confirm = true;
+    return true;
+}
 
-    for (int i = 0; i < enemyCount; i++) {
-        enemies[i].width = 80;
-        enemies[i].height = 80;
+// Simple autopilot: follow the lowest enemy (or the boss) and fire on every
+// other tick. This is the "tracker" sweep policy.
+void HeadlessBotInput(const GameWorld& world, long long tick, float dt, Rng& rng, InputState& input)
+{
+    input = { 0 };
+    if (BotHandleMenus(world, input)) return;
 
-        float x = 0;
-        float y = 0;
-        const int MAX_TRIES = 30;
-        int tries = 0;
+    float targetX = world.player.x;
+    if (world.game.gameState == STATE_BOSS_FIGHT) {
+        targetX = world.boss.x + BOSS_WIDTH / 2.0f;
+    }
+    else {
+        float lowestY = -1000.0f;
+        for (int i = 0; i < world.enemies.count; i++) {
+            if (world.enemies.cols.y[i] > lowestY) {
+                lowestY = world.enemies.cols.y[i];
+                targetX = world.enemies.cols.x[i] + ENEMY_WIDTH / 2.0f;
+            }
+        }
+    }
 
-        do {
-            x = (float)GetRandomValue(minX, maxX - enemies[i].width);
-            y = (float)GetRandomValue(60, 220);
-            tries++;
-        } while (OverlapsAnyPreviousEnemy(enemies, i, x, y,
-            enemies[i].width, enemies[i].height)
-            && tries < MAX_TRIES);
+    float playerCenter = world.player.x + world.player.width / 2.0f;
+    input.left = targetX < playerCenter - world.player.speed * dt;
+    input.right = targetX > playerCenter + world.player.speed * dt;
+    input.shoot = (tick % 2) == 0;
+}
 
-        enemies[i].x = x;
-        enemies[i].y = y;
+// Tracker that sidesteps whatever enemy or boss bullet is about to land on
+// it, moving away from the threat's center
+void DodgerBotInput(const GameWorld& world, long long tick, float dt, Rng& rng, InputState& input)
+{
+    const float LOOKAHEAD = 120.0f;
+    const float MARGIN = 10.0f;
+
+    HeadlessBotInput(world, tick, dt, rng, input);
+    if (input.confirm) return;
+
+    const Player& player = world.player;
+    float left = player.x - MARGIN;
+    float right = player.x + player.width + MARGIN;
+    float top = player.y - LOOKAHEAD;
+    float bottom = player.y + player.height;
+
+    // The lowest threat in the window lands first
+    float threatY = top;
+    float threatCenter = -1.0f;
+    for (int i = 0; i < world.enemies.count; i++) {
+        float x = world.enemies.cols.x[i];
+        float y = world.enemies.cols.y[i] + ENEMY_HEIGHT;
+        if (y >= threatY && y <= bottom + ENEMY_HEIGHT && x + ENEMY_WIDTH > left && x < right) {
+            threatY = y;
+            threatCenter = x + ENEMY_WIDTH / 2.0f;
+        }
+    }
+    for (int i = 0; i < world.bossBullets.count; i++) {
+        float x = world.bossBullets.cols.x[i];
+        float y = world.bossBullets.cols.y[i] + BOSS_BULLET_SIZE;
+        if (y >= threatY && y <= bottom + BOSS_BULLET_SIZE && x + BOSS_BULLET_SIZE > left && x < right) {
+            threatY = y;
+            threatCenter = x + BOSS_BULLET_SIZE / 2.0f;
+        }
+    }
+    if (threatCenter < 0.0f) return;
+
+    float playerCenter = player.x + player.width / 2.0f;
+    input.left = threatCenter >= playerCenter;
+    if (player.x < MARGIN) input.left = false;
+    if (player.x + player.width > SCREEN_WIDTH - MARGIN) input.left = true;
+    input.right = !input.left;
+}
+
+// Wanders: keeps its direction but changes it about once every 20 ticks
+// (or whenever it stands still), and fires on half the ticks
+void RandomBotInput(const GameWorld& world, long long tick, float dt, Rng& rng, InputState& input)
+{
+    input = { 0 };
+    if (BotHandleMenus(world, input)) return;
+
+    const Player& player = world.player;
+    bool wasLeft = player.x < player.prevX;
+    bool wasRight = player.x > player.prevX;
+
+    if ((!wasLeft && !wasRight) || RngRange(rng, 0, 19) == 0) {
+        int direction = RngRange(rng, 0, 2);
+        input.left = direction == 0;
+        input.right = direction == 1;
+    }
+    else {
+        input.left = wasLeft;
+        input.right = wasRight;
+    }
+    input.shoot = RngRange(rng, 0, 1) == 0;
+}
+
+// Co-op partner for headless netplay: sweeps across the screen and fires
+// on every third tick
+void PartnerBotInput(const GameWorld& world, long long tick, float dt, Rng& rng, InputState& input)
+{
+    input = { 0 };
+    if (BotHandleMenus(world, input)) return;
 
-        float randomOffset = (float)GetRandomValue(-3, 3) * 0.1f;
-        enemies[i].speed = baseSpeed + randomOffset;
-        if (enemies[i].speed < 0.5f) enemies[i].speed = 0.5f;
+    input.left = (tick / 90) % 2 == 0;
+    input.right = !input.left;
+    input.shoot = tick % 3 == 0;
+}
 
-        enemies[i].health = game.hitsToKill;
-        enemies[i].active = true;
+// Both sides play a bot (player 1 the tracker) for headlessTicks ticks as
+// fast as the link allows, then settle until every input is confirmed.
+// The two instances should print the same state checksum.
+void RunNetplayHeadless(GameWorld& world, const GameConfig& config, RollbackSession& netplay)
+{
+    InputState input;
+    GameEvents events;
+    const float tickDt = 1.0f / config.tickRate;
+    Rng botRng;
+    RngSeed(botRng, world.game.seed, RNG_STREAM_COUNT);
+    BotPolicyFn bot = netplay.localIndex == 0 ? HeadlessBotInput : PartnerBotInput;
+
+    auto start = chrono::steady_clock::now();
+
+    while (netplay.frame < config.headlessTicks) {
+        bot(world, netplay.frame, tickDt, botRng, input);
+        events.count = 0;
+        if (!AdvanceRollback(netplay, world, input, tickDt, events)) {
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
     }
 
-    for (int i = enemyCount; i < MAX_ENEMIES; i++) {
-        enemies[i].active = false;
-        enemies[i].health = 0;
+    // Wait for the last remote inputs, and for the peer to have ours
+    long long last = netplay.frame - 1;
+    long long deadline = NetClockMs() + NET_CONNECT_TIMEOUT_MS;
+    while ((netplay.remoteConfirmed < last || netplay.remoteAcked < last) && NetClockMs() < deadline) {
+        PollNetplay(netplay);
+        Resimulate(netplay, world, tickDt);
+        SendNetplayInputs(netplay);
+        this_thread::sleep_for(chrono::milliseconds(2));
     }
+    // Keep acking for a moment in case the peer is still waiting on us
+    long long linger = NetClockMs() + 250 + config.netDelayMs + config.netJitterMs;
+    while (NetClockMs() < linger) {
+        PollNetplay(netplay);
+        SendNetplayInputs(netplay);
+        this_thread::sleep_for(chrono::milliseconds(5));
+    }
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    // Snapshots leave out the co-op partner, so its fields are appended
+    // before hashing; a desync that only touched player 2 must show up too
+    const int partnerFields = 10;
+    static vector<unsigned char> snapshot;
+    snapshot.resize(SnapshotMaxBytes(world.enemies, world.bullets, world.bossBullets) + 4 * partnerFields);
+    int snapshotSize = SerializeSnapshot(world.game, world.player, world.enemies, world.bullets,
+        world.boss, world.bossBullets, snapshot.data(), (int)snapshot.size());
+
+    unsigned char* p = snapshot.data() + snapshotSize;
+    const Player& partner = world.partner;
+    PutSnapshotInt(p, world.coop);
+    PutSnapshotFloats(p, &partner.x, 1);
+    PutSnapshotFloats(p, &partner.y, 1);
+    PutSnapshotFloats(p, &partner.prevX, 1);
+    PutSnapshotFloats(p, &partner.prevY, 1);
+    PutSnapshotInt(p, partner.width);
+    PutSnapshotInt(p, partner.height);
+    PutSnapshotFloats(p, &partner.speed, 1);
+    PutSnapshotInt(p, partner.lives);
+    PutSnapshotInt(p, partner.isAlive);
+    snapshotSize += 4 * partnerFields;
+
+    cout << "seconds: " << seconds << '\n';
+    PrintNetplayStats(netplay);
+    cout << "confirmed: " << (netplay.remoteConfirmed >= last ? "yes" : "no") << '\n'
+        << "high score: " << world.game.highScore << '\n'
+        << "state checksum: " << hex << SnapshotChecksum(snapshot.data(), snapshotSize) << dec << '\n';
 }
 
-void InitGame(GameState& game, Player& player,
-    Enemy enemies[], int& enemyCount,
-    Bullet bullets[], int maxBullets,
-    Boss& boss, Bullet bossBullets[], int maxBossBullets)
+// Plays the bot for headlessTicks ticks, or a replay (--play) to its end
+// at full speed. The final state checksum lets two runs be compared.
+void RunHeadless(GameWorld& world, const GameConfig& config, ReplaySession& replay)
 {
-    game.score = 0;
-    game.level = 1;
-    game.highScore = 0;
-    game.hitsToKill = 1;
-    game.gameOver = false;
-    game.gameWon = false;
-    game.gameState = STATE_MENU;
-    game.bossActive = false;
+    InputState input;
+    GameEvents events;
+    long long totalEvents = 0;
+    int gamesFinished = 0;
+    const float tickDt = 1.0f / config.tickRate;
+
+    auto start = chrono::steady_clock::now();
+
+    bool playing = replay.reader.active;
+    long long tick = 0;
+
+    Rng botRng;
+    RngSeed(botRng, world.game.seed, RNG_STREAM_COUNT);
+
+    for (; playing ? replay.reader.active : tick < config.headlessTicks; tick++) {
+        HeadlessBotInput(world, tick, tickDt, botRng, input);
+        events.count = 0;
+        ReplayBeforeTick(replay, input);
+        long long t = ProfileBegin();
+        StepSimulation(world, input, tickDt, events);
+        ProfileEnd(PHASE_TICK, t);
+        ReplayAfterTick(replay, world, events);
+        ProfileNextFrame();
+        totalEvents += events.count;
+
+        for (int i = 0; i < events.count; i++) {
+            if (events.items[i].type == EVENT_GAME_OVER || events.items[i].type == EVENT_BOSS_DEFEATED) {
+                gamesFinished++;
+            }
+        }
+    }
 
-    InitPlayer(player);
-    player.lives = 3;
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
 
-    
+    static vector<unsigned char> snapshot;
+    snapshot.resize(SnapshotMaxBytes(world.enemies, world.bullets, world.bossBullets));
+    int snapshotSize = SerializeSnapshot(world.game, world.player, world.enemies, world.bullets,
+        world.boss, world.bossBullets, snapshot.data(), (int)snapshot.size());
 
-    InitBullets(bullets, maxBullets);
-    InitEnemiesForLevel(game, enemies, enemyCount);
-    InitBoss(boss);
-    InitBossBullets(bossBullets, maxBossBullets);
+    cout << "ticks: " << tick << '\n'
+        << "seconds: " << seconds << '\n'
+        << "ticks/sec: " << (seconds > 0 ? tick / seconds : 0.0) << '\n'
+        << "events: " << totalEvents << '\n'
+        << "games finished: " << gamesFinished << '\n'
+        << "high score: " << world.game.highScore << '\n'
+        << "state checksum: " << hex << SnapshotChecksum(snapshot.data(), snapshotSize) << dec << '\n';
+
+    if (config.tracePath != NULL) {
+        WriteChromeTrace(config.tracePath);
+    }
 }
 
 // ---------------------------------------------------------
-// Main game loop
+// Balance sweeps
 // ---------------------------------------------------------
-void RunGameLoop(GameState& game, Player& player,
-    Enemy enemies[], int& enemyCount,
-    Bullet bullets[], int maxBullets,
-    Boss& boss, Bullet bossBullets[], int maxBossBullets, const GameResources& res)
+BalanceParams DefaultBalance()
 {
-    while (!WindowShouldClose())
-    {
-        UpdateMusicStream(res.gameTheme);
-        if (IsKeyPressed(KEY_ESCAPE)) {
-            SaveGame(game, player, boss);
-            break;
-        }
+    BalanceParams balance;
+    balance.enemiesBase = 3;
+    balance.enemiesPerLevel = 3;
+    balance.speedBase = 60.0f;
+    balance.speedPerLevel = 18.0f;
+    balance.scorePerLevel = 10;
+    balance.hitsPerWave = 1;
+    balance.bossHealth = BOSS_INITIAL_HEALTH;
+    return balance;
+}
 
-        
-        if (game.gameState == STATE_MENU) {
-           
-            HandleStartScreenInput(game, player, enemies, enemyCount, bullets, maxBullets, boss, bossBullets, MAX_BOSS_BULLETS);
-        }
-        else if (game.gameState == STATE_PLAYING || game.gameState == STATE_BOSS_FIGHT) {
-            UpdateGame(game, player, enemies, enemyCount, bullets, maxBullets, boss, bossBullets, MAX_BOSS_BULLETS, res);
-        }
-        else if (game.gameState == STATE_GAME_OVER) {
-           
-            HandleGameOverInput(game, player, enemies, enemyCount, bullets, maxBullets, boss, bossBullets, MAX_BOSS_BULLETS, res);
-        }
-        else if (game.gameState == STATE_WIN) {
-           
-            HandleWinScreenInput(game, player, enemies, enemyCount, bullets, maxBullets, boss, bossBullets, MAX_BOSS_BULLETS, res);
-        }
+// Names match the sweep CSV columns
+bool SetBalanceParam(BalanceParams& balance, const char* name, float value)
+{
+    if (strcmp(name, "enemies_base") == 0) balance.enemiesBase = (int)value;
+    else if (strcmp(name, "enemies_per_level") == 0) balance.enemiesPerLevel = (int)value;
+    else if (strcmp(name, "speed_base") == 0) balance.speedBase = value;
+    else if (strcmp(name, "speed_per_level") == 0) balance.speedPerLevel = value;
+    else if (strcmp(name, "score_per_level") == 0) balance.scorePerLevel = (int)value;
+    else if (strcmp(name, "hits_per_wave") == 0) balance.hitsPerWave = (int)value;
+    else if (strcmp(name, "boss_health") == 0) balance.bossHealth = (int)value;
+    else return false;
+    return true;
+}
 
-     
-        BeginDrawing();
-        ClearBackground(BLACK);
+// Parses "name=v1,v2,..."
+bool ParseSweepAxis(const char* spec, SweepAxis& axis)
+{
+    const char* eq = strchr(spec, '=');
+    if (eq == NULL || eq == spec || eq - spec >= (int)sizeof(axis.param)) return false;
+
+    memcpy(axis.param, spec, eq - spec);
+    axis.param[eq - spec] = '\0';
+
+    BalanceParams scratch = DefaultBalance();
+    if (!SetBalanceParam(scratch, axis.param, 0.0f)) return false;
+
+    axis.values.clear();
+    const char* p = eq + 1;
+    while (*p != '\0') {
+        char* end = NULL;
+        float value = strtof(p, &end);
+        if (end == p) return false;
+        axis.values.push_back(value);
+        p = *end == ',' ? end + 1 : end;
+        if (*end != ',' && *end != '\0') return false;
+    }
+    return !axis.values.empty();
+}
 
-        if (game.gameState == STATE_MENU) {
-            DrawStartScreen(game);
+// Plays one game from the start screen until the boss falls, the last life
+// is lost or maxTicks pass. The bot's stream is seeded from the game seed.
+GameOutcome PlayBalanceGame(GameWorld& world, const BalanceParams& balance, BotPolicyFn policy,
+    unsigned int seed, float dt, long long maxTicks)
+{
+    GameOutcome outcome = {};
+    outcome.bossTick = -1;
+
+    InitGame(world.game, world.player, world.enemies, world.bullets, world.boss, world.bossBullets, world.arena,
+        seed, balance);
+
+    Rng botRng;
+    RngSeed(botRng, seed, RNG_STREAM_COUNT);
+
+    InputState input;
+    GameEvents events;
+    bool over = false;
+    long long tick = 0;
+
+    for (; tick < maxTicks && !over; tick++) {
+        policy(world, tick, dt, botRng, input);
+
+        // Read before the step, so a hit counts against the stage it happened in
+        int stage = world.game.gameState == STATE_BOSS_FIGHT ? MAX_LEVEL : world.game.level - 1;
+        if (stage < 0) stage = 0;
+        if (stage >= BALANCE_STAGES) stage = BALANCE_STAGES - 1;
+
+        events.count = 0;
+        StepSimulation(world, input, dt, events);
+
+        for (int i = 0; i < events.count; i++) {
+            GameEventType type = events.items[i].type;
+            if (type == EVENT_PLAYER_HIT || type == EVENT_GAME_OVER) {
+                outcome.livesLost[stage]++;
+            }
+            if (type == EVENT_GAME_OVER) {
+                over = true;
+            }
+            if (type == EVENT_BOSS_DEFEATED) {
+                outcome.won = true;
+                over = true;
+            }
         }
-        else if (game.gameState == STATE_PLAYING || game.gameState == STATE_BOSS_FIGHT) {
-            DrawGame(game, player, enemies, enemyCount, bullets, maxBullets, boss, bossBullets, MAX_BOSS_BULLETS, res);
+
+        if (outcome.bossTick < 0 && world.game.gameState == STATE_BOSS_FIGHT) {
+            outcome.bossTick = tick + 1;
         }
-        else if (game.gameState == STATE_GAME_OVER) {
-            DrawGameOverScreen(game);
+    }
+
+    outcome.ticks = tick;
+    outcome.timedOut = !over;
+    return outcome;
+}
+
+// Workers take games off the shared counter in small batches, so a thread
+// stuck on long games doesn't leave the others idle at the end
+void RunBalanceSweepWorker(BalanceSweep* sweep)
+{
+    const long long BATCH = 8;
+
+    GameWorld* world = new GameWorld();
+    InitLevelArena(world->arena, world->enemies, world->bullets, world->bossBullets, sweep->capacities);
+    InitBroadphase(world->broadphase, sweep->capacities);
+
+    for (;;) {
+        long long first = sweep->nextJob.fetch_add(BATCH);
+        if (first >= sweep->jobs) break;
+
+        long long last = first + BATCH < sweep->jobs ? first + BATCH : sweep->jobs;
+        for (long long job = first; job < last; job++) {
+            long long game = job % sweep->games;
+            long long policy = job / sweep->games % sweep->policyCount;
+            long long combo = job / (sweep->games * sweep->policyCount);
+
+            sweep->outcomes[job] = PlayBalanceGame(*world, sweep->balances[combo],
+                sweep->policies[policy].input, sweep->seed + (unsigned int)game, sweep->dt, sweep->maxTicks);
         }
-        else if (game.gameState == STATE_WIN) {
-            DrawWinScreen(game);
+    }
+
+    FreeArena(world->arena);
+    delete world;
+}
+
+// Plays sweepGames games for every combination of --vary values under every
+// bot policy and writes one CSV row per (combination, policy). Game i uses
+// seed + i in every row, so rows differ by their parameters, not their luck.
+void RunBalanceSweep(const GameConfig& config)
+{
+    static const BotPolicy policies[] = {
+        { "tracker", HeadlessBotInput },
+        { "dodger", DodgerBotInput },
+        { "random", RandomBotInput },
+    };
+
+    static BalanceSweep sweep;
+    sweep.policies = policies;
+    sweep.policyCount = (int)(sizeof(policies) / sizeof(policies[0]));
+    sweep.games = config.sweepGames;
+    sweep.seed = config.seeded ? config.seed : NewRandomSeed();
+    sweep.dt = 1.0f / config.tickRate;
+    sweep.maxTicks = (long long)config.tickRate * BALANCE_MAX_GAME_SECONDS;
+    sweep.capacities = config.capacities;
+
+    // Combination c picks its value on each axis from the digits of c in a
+    // mixed radix; parameters without a --vary keep their default
+    long long combos = 1;
+    for (const SweepAxis& axis : config.sweepAxes) {
+        combos *= (long long)axis.values.size();
+    }
+    sweep.balances.resize(combos);
+    for (long long c = 0; c < combos; c++) {
+        sweep.balances[c] = DefaultBalance();
+        long long rest = c;
+        for (const SweepAxis& axis : config.sweepAxes) {
+            long long n = (long long)axis.values.size();
+            SetBalanceParam(sweep.balances[c], axis.param, axis.values[rest % n]);
+            rest /= n;
         }
+    }
 
-        EndDrawing();
+    sweep.jobs = combos * sweep.policyCount * sweep.games;
+    sweep.outcomes.assign(sweep.jobs, GameOutcome());
+    sweep.nextJob = 0;
+
+    int threadCount = config.sweepThreads > 0 ? config.sweepThreads : (int)thread::hardware_concurrency();
+    if (threadCount < 1) threadCount = 1;
+
+    auto start = chrono::steady_clock::now();
+
+    vector<thread> workers;
+    for (int i = 0; i < threadCount; i++) {
+        workers.push_back(thread(RunBalanceSweepWorker, &sweep));
+    }
+    for (thread& worker : workers) {
+        worker.join();
+    }
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    ofstream csv(config.sweepPath);
+    if (!csv.is_open()) {
+        cout << "could not write " << config.sweepPath << '\n';
+        return;
+    }
+
+    csv << "policy,enemies_base,enemies_per_level,speed_base,speed_per_level,score_per_level,hits_per_wave,boss_health,"
+        << "games,win_rate,timeout_rate,boss_rate,boss_time_mean_s,boss_time_p10_s,boss_time_p50_s,boss_time_p90_s,"
+        << "game_time_mean_s";
+    for (int stage = 0; stage < MAX_LEVEL; stage++) {
+        csv << ",lives_lost_l" << stage + 1;
+    }
+    csv << ",lives_lost_boss\n";
+
+    long long totalTicks = 0;
+    vector<long long> bossTicks;
+
+    for (long long c = 0; c < combos; c++) {
+        for (int policy = 0; policy < sweep.policyCount; policy++) {
+            const GameOutcome* games = &sweep.outcomes[(c * sweep.policyCount + policy) * sweep.games];
+
+            long long wins = 0;
+            long long timeouts = 0;
+            long long ticks = 0;
+            long long livesLost[BALANCE_STAGES] = { 0 };
+            bossTicks.clear();
+
+            for (long long g = 0; g < sweep.games; g++) {
+                wins += games[g].won;
+                timeouts += games[g].timedOut;
+                ticks += games[g].ticks;
+                if (games[g].bossTick >= 0) bossTicks.push_back(games[g].bossTick);
+                for (int stage = 0; stage < BALANCE_STAGES; stage++) {
+                    livesLost[stage] += games[g].livesLost[stage];
+                }
+            }
+            totalTicks += ticks;
+            sort(bossTicks.begin(), bossTicks.end());
+
+            double n = (double)sweep.games;
+            double bossMean = 0.0;
+            for (long long t : bossTicks) bossMean += (double)t;
+            if (!bossTicks.empty()) bossMean /= bossTicks.size();
+
+            const BalanceParams& b = sweep.balances[c];
+            csv << policies[policy].name << ','
+                << b.enemiesBase << ',' << b.enemiesPerLevel << ','
+                << b.speedBase << ',' << b.speedPerLevel << ','
+                << b.scorePerLevel << ',' << b.hitsPerWave << ',' << b.bossHealth << ','
+                << sweep.games << ','
+                << wins / n << ',' << timeouts / n << ',' << bossTicks.size() / n << ','
+                << bossMean * sweep.dt;
+            for (double q : { 0.1, 0.5, 0.9 }) {
+                csv << ',';
+                if (!bossTicks.empty()) csv << bossTicks[(size_t)(q * (bossTicks.size() - 1))] * sweep.dt;
+            }
+            csv << ',' << ticks / n * sweep.dt;
+            for (int stage = 0; stage < BALANCE_STAGES; stage++) {
+                csv << ',' << livesLost[stage] / n;
+            }
+            csv << '\n';
+        }
     }
+
+    cout << "games: " << sweep.jobs << '\n'
+        << "threads: " << threadCount << '\n'
+        << "seconds: " << seconds << '\n'
+        << "games/sec: " << (seconds > 0 ? sweep.jobs / seconds : 0.0) << '\n'
+        << "ticks/sec: " << (seconds > 0 ? totalTicks / seconds : 0.0) << '\n'
+        << "seed: " << sweep.seed << '\n';
 }
 
 // ---------------------------------------------------------
@@ -456,7 +5509,7 @@ void DrawStartScreen(const GameState& game)
     DrawText("- You start with 3 lives.", 60, y, 20, LIGHTGRAY); y += 24;
     DrawText("- Colliding with an enemy costs 1 life.", 60, y, 20, LIGHTGRAY); y += 24;
     DrawText("- Each destroyed enemy gives 1 point.", 60, y, 20, LIGHTGRAY); y += 24;
-    DrawText("- To reach the next level: score >= level * 10.", 60, y, 20, LIGHTGRAY); y += 24;
+    DrawText(TextFormat("- To reach the next level: score >= level * %d.", game.balance.scorePerLevel), 60, y, 20, LIGHTGRAY); y += 24;
     DrawText("- If you destroy all enemies but don't have", 60, y, 20, LIGHTGRAY); y += 20;
     DrawText("  enough score, a new, tougher wave spawns.", 60, y, 20, LIGHTGRAY); y += 24;
     DrawText("- There are 5 levels, then the BOSS FIGHT starts.", 60, y, 20, LIGHTGRAY); y += 32;
@@ -475,26 +5528,33 @@ void DrawStartScreen(const GameState& game)
 
 
 void HandleStartScreenInput(GameState& game, Player& player,
-    Enemy enemies[], int& enemyCount,
-    Bullet bullets[], int maxBullets,
-    Boss& boss, Bullet bossBullets[], int maxBossBullets)
+    EnemyPool& enemies, BulletPool& bullets,
+    Boss& boss, BossBulletPool& bossBullets, Arena& arena, const InputState& input, GameEvents& events)
 {
-    if (IsKeyPressed(KEY_ENTER) || IsKeyPressed(KEY_N)) {
-        ResetGameToLevel1(game, player, enemies, enemyCount, bullets, maxBullets, boss, bossBullets, maxBossBullets);
+    if (input.confirm || input.newGame) {
+        ResetGameToLevel1(game, player, enemies, bullets, boss, bossBullets, arena);
         game.gameState = STATE_PLAYING;
     }
-    else if (IsKeyPressed(KEY_L)) {
-        LoadGame(game, player, boss);
+    else if (input.loadGame) {
+        PushEvent(events, EVENT_GAME_LOADED, 0, 0);
+
+        // A snapshot taken mid-game resumes exactly; otherwise start a
+        // fresh wave at the saved level
+        if (LoadGame(game, player, enemies, bullets, boss, bossBullets)
+            && (game.gameState == STATE_PLAYING || game.gameState == STATE_BOSS_FIGHT)) {
+            return;
+        }
 
-        InitBullets(bullets, maxBullets);
-        InitBossBullets(bossBullets, maxBossBullets);
+        InitBullets(bullets);
+        InitBossBullets(bossBullets);
+        if (player.lives < 1) player.lives = 1;
 
         if (game.bossActive) {
             boss.active = true;
             game.gameState = STATE_BOSS_FIGHT;
         }
         else {
-            InitEnemiesForLevel(game, enemies, enemyCount);
+            InitEnemiesForLevel(game, enemies);
             player.isAlive = true;
             game.gameOver = false;
             game.gameWon = false;
@@ -523,14 +5583,13 @@ void DrawGameOverScreen(const GameState& game)
 
 
 void HandleGameOverInput(GameState& game, Player& player,
-    Enemy enemies[], int& enemyCount,
-    Bullet bullets[], int maxBullets,
-    Boss& boss, Bullet bossBullets[], int maxBossBullets, const GameResources& res)
+    EnemyPool& enemies, BulletPool& bullets,
+    Boss& boss, BossBulletPool& bossBullets, Arena& arena, const InputState& input, GameEvents& events)
 {
-    if (IsKeyPressed(KEY_ENTER)) {
-        ResetGameToLevel1(game, player, enemies, enemyCount, bullets, maxBullets, boss, bossBullets, maxBossBullets);
+    if (input.confirm) {
+        ResetGameToLevel1(game, player, enemies, bullets, boss, bossBullets, arena);
         game.gameState = STATE_PLAYING;
-        PlayMusicStream(res.gameTheme);
+        PushEvent(events, EVENT_GAME_RESTARTED, 0, 0);
     }
 }
 
@@ -554,151 +5613,177 @@ void DrawWinScreen(const GameState& game)
 
 
 void HandleWinScreenInput(GameState& game, Player& player,
-    Enemy enemies[], int& enemyCount,
-    Bullet bullets[], int maxBullets,
-    Boss& boss, Bullet bossBullets[], int maxBossBullets, const GameResources& res)
+    EnemyPool& enemies, BulletPool& bullets,
+    Boss& boss, BossBulletPool& bossBullets, Arena& arena, const InputState& input, GameEvents& events)
 {
-    if (IsKeyPressed(KEY_ENTER)) {
-        ResetGameToLevel1(game, player, enemies, enemyCount, bullets, maxBullets, boss, bossBullets, maxBossBullets);
+    if (input.confirm) {
+        ResetGameToLevel1(game, player, enemies, bullets, boss, bossBullets, arena);
         game.gameState = STATE_PLAYING;
-        PlayMusicStream(res.gameTheme);
+        PushEvent(events, EVENT_GAME_RESTARTED, 0, 0);
     }
 }
 
 // ---------------------------------------------------------
 // Game update & drawing (PLAYING state)
 // ---------------------------------------------------------
-void UpdateGame(GameState& game, Player& player,
-    Enemy enemies[], int& enemyCount,
-    Bullet bullets[], int maxBullets,
-    Boss& boss, Bullet bossBullets[], int maxBossBullets, const GameResources& res)
+// The partner is only alive in co-op. At most one player is hit per tick;
+// a hit resets the playfield for both anyway.
+void UpdateGame(GameState& game, Player& player, Player& partner,
+    EnemyPool& enemies, BulletPool& bullets,
+    Boss& boss, BossBulletPool& bossBullets, Arena& arena, Broadphase& broadphase,
+    const InputState& input, const InputState& partnerInput, float dt, GameEvents& events)
 {
-    UpdatePlayer(player);
-    HandlePlayerShooting(player, bullets, maxBullets, res);
-    UpdateBullets(bullets, maxBullets);
+    long long t = ProfileBegin();
+
+    UpdatePlayer(player, input, dt);
+    HandlePlayerShooting(player, bullets, input, events);
+    if (partner.isAlive) {
+        UpdatePlayer(partner, partnerInput, dt);
+        HandlePlayerShooting(partner, bullets, partnerInput, events);
+    }
+    UpdateBullets(bullets, dt);
 
     if (game.gameState == STATE_PLAYING) {
-        UpdateEnemies(enemies, enemyCount);
-        CheckBulletEnemyCollisions(bullets, maxBullets, enemies, enemyCount, game, res);
-        if (CheckEnemyPlayerCollisions(enemies, enemyCount, player)) {
-            HandlePlayerHit(game, player, enemies, enemyCount, bullets, maxBullets, boss, bossBullets, maxBossBullets, res);
+        UpdateEnemies(enemies, dt);
+        t = ProfileLap(PHASE_MOVE, t);
+        BuildSpatialGrid(broadphase.enemies, enemies.cols.x, enemies.cols.y, enemies.count);
+        broadphase.enemies.maxStep = MaxStep(enemies.cols.y, enemies.cols.prevY, enemies.count);
+        t = ProfileLap(PHASE_BROADPHASE, t);
+
+        CheckBulletEnemyCollisions(bullets, enemies, broadphase.enemies, events);
+        if (CheckEnemyPlayerCollisions(enemies, broadphase.enemies, player)) {
+            PushEvent(events, EVENT_PLAYER_HIT, player.x, player.y);
         }
+        else if (CheckEnemyPlayerCollisions(enemies, broadphase.enemies, partner)) {
+            PushEvent(events, EVENT_PLAYER_HIT, partner.x, partner.y);
+        }
+        RemoveDeadEnemies(enemies);
+        t = ProfileLap(PHASE_COLLISIONS, t);
     }
     else if (game.gameState == STATE_BOSS_FIGHT) {
-        UpdateBoss(boss);
-        HandleBossShooting(boss, bossBullets, maxBossBullets, res);
-        UpdateBossBullets(bossBullets, maxBossBullets);
-
-        CheckBulletBossCollisions(bullets, maxBullets, boss, game, res);
-
-        if (CheckBossPlayerCollision(boss, player) || CheckBossBulletPlayerCollisions(bossBullets, maxBossBullets, player)) {
-            HandlePlayerHit(game, player, enemies, enemyCount, bullets, maxBullets, boss, bossBullets, maxBossBullets, res);
+        UpdateBoss(boss, dt);
+        HandleBossShooting(boss, bossBullets, player, game.balance.bossHealth, dt, events);
+        UpdateBossBullets(bossBullets, dt);
+        t = ProfileLap(PHASE_MOVE, t);
+        BuildSpatialGrid(broadphase.bossBullets, bossBullets.cols.x, bossBullets.cols.y, bossBullets.count);
+        broadphase.bossBullets.maxStep = max(MaxStep(bossBullets.cols.x, bossBullets.cols.prevX, bossBullets.count),
+            MaxStep(bossBullets.cols.y, bossBullets.cols.prevY, bossBullets.count));
+        t = ProfileLap(PHASE_BROADPHASE, t);
+
+        CheckBulletBossCollisions(bullets, boss, events);
+
+        if (CheckBossPlayerCollision(boss, player) || CheckBossBulletPlayerCollisions(bossBullets, broadphase.bossBullets, player)) {
+            PushEvent(events, EVENT_PLAYER_HIT, player.x, player.y);
+        }
+        else if (CheckBossPlayerCollision(boss, partner) || CheckBossBulletPlayerCollisions(bossBullets, broadphase.bossBullets, partner)) {
+            PushEvent(events, EVENT_PLAYER_HIT, partner.x, partner.y);
         }
+        t = ProfileLap(PHASE_COLLISIONS, t);
     }
 
-    UpdateScoreAndLevel(game, player, enemies, enemyCount, bullets, maxBullets, boss, bossBullets, maxBossBullets, res);
+    ApplyGameEvents(game, player, partner, enemies, bullets, boss, bossBullets, events);
+    UpdateScoreAndLevel(game, player, enemies, bullets, boss, bossBullets, arena);
+    ProfileEnd(PHASE_SCORE, t);
 }
 
-void DrawGame(const GameState& game, const Player& player,
-    const Enemy enemies[], int enemyCount,
-    const Bullet bullets[], int maxBullets,
-    const Boss& boss, const Bullet bossBullets[], int maxBossBullets, const GameResources& res)
+void DrawGame(const RenderFrame& frame, const ParticleSystem& particles, float alpha,
+    const GameResources& res, SpriteBatch& batch, RenderCache& cache)
 {
+    // Positions are blended between the last two ticks by alpha
+    // Every sprite goes through the batch and is drawn by one flush at the end.
+    const SpriteAtlas& atlas = res.atlas;
+    const Player& player = frame.player;
+    const Player& partner = frame.partner;
+    const Boss& boss = frame.boss;
+    BeginSpriteBatch(batch);
+
     // Draw Background
-    if (res.backgroundTexture.id > 0) {
-        Rectangle sourceRec = { 0.0f, 0.0f, (float)res.backgroundTexture.width, (float)res.backgroundTexture.height };
+    if (atlas.loaded[SPRITE_BACKGROUND]) {
         Rectangle destRec = { 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT };
-        Vector2 origin = { 0, 0 };
-        DrawTexturePro(res.backgroundTexture, sourceRec, destRec, origin, 0.0f, WHITE);
+        SubmitSprite(batch, LAYER_BACKGROUND, SPRITE_BACKGROUND, destRec, WHITE);
     }
 
     // Draw Player
-    if (player.isAlive) {
-        Rectangle sourceRec = { 0.0f, 0.0f, (float)res.playerTexture.width, (float)res.playerTexture.height };
-        Rectangle destRec = { player.x, player.y, player.width, player.height };
-        Vector2 origin = { 0, 0 };
-        DrawTexturePro(res.playerTexture, sourceRec, destRec, origin, 0.0f, WHITE);
+    if (player.isAlive && atlas.loaded[SPRITE_PLAYER]) {
+        float x = player.prevX + (player.x - player.prevX) * alpha;
+        float y = player.prevY + (player.y - player.prevY) * alpha;
+        Rectangle destRec = { x, y, (float)player.width, (float)player.height };
+        SubmitSprite(batch, LAYER_PLAYER, SPRITE_PLAYER, destRec, WHITE);
+    }
+    if (partner.isAlive && atlas.loaded[SPRITE_PLAYER]) {
+        float x = partner.prevX + (partner.x - partner.prevX) * alpha;
+        float y = partner.prevY + (partner.y - partner.prevY) * alpha;
+        Rectangle destRec = { x, y, (float)partner.width, (float)partner.height };
+        SubmitSprite(batch, LAYER_PLAYER, SPRITE_PLAYER, destRec, SKYBLUE);
     }
 
     // Draw Enemies 
-    for (int i = 0; i < enemyCount; i++) {
-        if (enemies[i].active && game.gameState == STATE_PLAYING) {
-            if (res.enemyTexture.id > 0) {
-                Rectangle source = { 0, 0, (float)res.enemyTexture.width, (float)res.enemyTexture.height };
-                Rectangle dest = { enemies[i].x, enemies[i].y, enemies[i].width, enemies[i].height };
-                Vector2 origin = { 0, 0 };
-                DrawTexturePro(res.enemyTexture, source, dest, origin, 0.0f, WHITE);
-            }
+    if (frame.game.gameState == STATE_PLAYING && atlas.loaded[SPRITE_ENEMY]) {
+        for (int i = 0; i < frame.enemyCount; i++) {
+            float y = frame.enemyPrevY[i] + (frame.enemyY[i] - frame.enemyPrevY[i]) * alpha;
+            Rectangle dest = { frame.enemyX[i], y, (float)ENEMY_WIDTH, (float)ENEMY_HEIGHT };
+            SubmitSprite(batch, LAYER_ENEMIES, SPRITE_ENEMY, dest, WHITE);
         }
     }
 
-    // Draw Bullets (Player)
-    for (int i = 0; i < maxBullets; i++) {
-        if (bullets[i].active) {
-            if (res.bulletTexture.id > 0) {
-                Rectangle source = { 0, 0, (float)res.bulletTexture.width, (float)res.bulletTexture.height };
-                Rectangle dest = { bullets[i].x, bullets[i].y, bullets[i].width, bullets[i].height };
-                Vector2 origin = { 0, 0 };
-                DrawTexturePro(res.bulletTexture, source, dest, origin, 0.0f, WHITE);
-            }
-            else {
-                DrawRectangle((int)bullets[i].x, (int)bullets[i].y, (int)bullets[i].width, (int)bullets[i].height, YELLOW);
-            }
+    // Draw Bullets (Player)
+    bool bulletLoaded = atlas.loaded[SPRITE_BULLET];
+    for (int i = 0; i < frame.bulletCount; i++) {
+        float y = frame.bulletPrevY[i] + (frame.bulletY[i] - frame.bulletPrevY[i]) * alpha;
+        Rectangle dest = { frame.bulletX[i], y, (float)BULLET_WIDTH, (float)BULLET_HEIGHT };
+        if (bulletLoaded) {
+            SubmitSprite(batch, LAYER_BULLETS, SPRITE_BULLET, dest, WHITE);
+        }
+        else {
+            SubmitSprite(batch, LAYER_BULLETS, SPRITE_WHITE, dest, YELLOW);
         }
     }
 
     // Draw Boss
     if (boss.active) {
-        if (res.bossTexture.id > 0) {
-            Rectangle source = { 0, 0, (float)res.bossTexture.width, (float)res.bossTexture.height };
-            Rectangle dest = { boss.x, boss.y, boss.width, boss.height };
-            Vector2 origin = { 0, 0 };
-            DrawTexturePro(res.bossTexture, source, dest, origin, 0.0f, WHITE);
+        float x = boss.prevX + (boss.x - boss.prevX) * alpha;
+        Rectangle dest = { x, boss.y, (float)BOSS_WIDTH, (float)BOSS_HEIGHT };
+        if (atlas.loaded[SPRITE_BOSS]) {
+            SubmitSprite(batch, LAYER_BOSS, SPRITE_BOSS, dest, WHITE);
         }
         else {
-            DrawRectangle((int)boss.x, (int)boss.y, (int)boss.width, (int)boss.height, PURPLE);
+            SubmitSprite(batch, LAYER_BOSS, SPRITE_WHITE, dest, PURPLE);
         }
     }
 
     // Draw Boss Bullets
-    for (int i = 0; i < maxBossBullets; i++) {
-        if (bossBullets[i].active) {
-            if (res.bossBulletTexture.id > 0) {
-                Rectangle source = { 0, 0, (float)res.bossBulletTexture.width, (float)res.bossBulletTexture.height };
-                Rectangle dest = { bossBullets[i].x, bossBullets[i].y, bossBullets[i].width, bossBullets[i].height };
-                Vector2 origin = { 0, 0 };
-                DrawTexturePro(res.bossBulletTexture, source, dest, origin, 0.0f, RED);
-            }
-            else {
-                DrawRectangle((int)bossBullets[i].x, (int)bossBullets[i].y, (int)bossBullets[i].width, (int)bossBullets[i].height, RED);
-            }
-        }
+    for (int i = 0; i < frame.bossBulletCount; i++) {
+        float x = frame.bossBulletPrevX[i] + (frame.bossBulletX[i] - frame.bossBulletPrevX[i]) * alpha;
+        float y = frame.bossBulletPrevY[i] + (frame.bossBulletY[i] - frame.bossBulletPrevY[i]) * alpha;
+        Rectangle dest = { x, y, (float)BOSS_BULLET_SIZE, (float)BOSS_BULLET_SIZE };
+        SubmitSprite(batch, LAYER_BOSS_BULLETS, bulletLoaded ? SPRITE_BULLET : SPRITE_WHITE, dest, RED);
     }
 
-    DrawHUD(game, player, boss);
+    FlushSpriteBatch(batch, atlas);
+    DrawParticles(particles, atlas, alpha);
+
+    DrawHUD(cache, frame.game, player, boss);
 }
-bool AreAllEnemiesDestroyed(const Enemy enemies[], int enemyCount)
+bool AreAllEnemiesDestroyed(const EnemyPool& enemies)
 {
-    for (int i = 0; i < enemyCount; i++) {
-        if (enemies[i].active) {
-            return false;
-        }
-    }
-    return true;
+    return enemies.count == 0;
 }
 
 // ---------------------------------------------------------
 // Player movement + shooting
 // ---------------------------------------------------------
-void UpdatePlayer(Player& player)
+void UpdatePlayer(Player& player, const InputState& input, float dt)
 {
     if (!player.isAlive) return;
 
-    if (IsKeyDown(KEY_LEFT)) {
-        player.x -= player.speed;
+    player.prevX = player.x;
+    player.prevY = player.y;
+
+    if (input.left) {
+        player.x -= player.speed * dt;
     }
-    if (IsKeyDown(KEY_RIGHT)) {
-        player.x += player.speed;
+    if (input.right) {
+        player.x += player.speed * dt;
     }
 
    
@@ -709,18 +5794,14 @@ void UpdatePlayer(Player& player)
 }
 
 void HandlePlayerShooting(const Player& player,
-    Bullet bullets[], int maxBullets, const GameResources& res)
+    BulletPool& bullets, const InputState& input, GameEvents& events)
 {
-    if (IsKeyPressed(KEY_SPACE)) {
-        for (int i = 0; i < maxBullets; i++) {
-            if (!bullets[i].active) {
-                PlaySound(res.shootSound);
+    if (input.shoot) {
+        float x = player.x + player.width / 2.0f - BULLET_WIDTH / 2.0f;
+        float y = player.y - BULLET_HEIGHT;
 
-                bullets[i].active = true;
-                bullets[i].x = player.x + player.width / 2.0f - bullets[i].width / 2.0f;
-                bullets[i].y = player.y - bullets[i].height;
-                break;
-            }
+        if (SpawnBullet(bullets, x, y)) {
+            PushEvent(events, EVENT_PLAYER_SHOT, x, y);
         }
     }
 }
@@ -728,336 +5809,482 @@ void HandlePlayerShooting(const Player& player,
 // ---------------------------------------------------------
 // Bullets & Enemies & Boss
 // ---------------------------------------------------------
-void UpdateBullets(Bullet bullets[], int maxBullets)
+void UpdateBullets(BulletPool& bullets, float dt)
 {
-    for (int i = 0; i < maxBullets; i++) {
-        if (bullets[i].active) {
-            bullets[i].y -= bullets[i].speed;
-            if (bullets[i].y + bullets[i].height < 0) {
-                bullets[i].active = false;
-            }
-        }
-    }
+    IntegrateY(bullets.cols.y, bullets.cols.prevY, bullets.count, -BULLET_SPEED * dt);
+    CullBulletsOutsideY(bullets, (float)-BULLET_HEIGHT, (float)SCREEN_HEIGHT);
 }
 
-void UpdateEnemies(Enemy enemies[], int enemyCount)
+void UpdateEnemies(EnemyPool& enemies, float dt)
 {
-    for (int i = 0; i < enemyCount; i++) {
-        if (enemies[i].active) {
-            enemies[i].y += enemies[i].speed;
-
-            if (enemies[i].y > SCREEN_HEIGHT) {
-                enemies[i].y = -enemies[i].height;
-            }
-        }
-    }
+    IntegrateAndWrapY(enemies.cols.y, enemies.cols.prevY, enemies.cols.speed, enemies.count,
+        dt, (float)SCREEN_HEIGHT, (float)-ENEMY_HEIGHT);
 }
 
-void UpdateBoss(Boss& boss)
+void UpdateBoss(Boss& boss, float dt)
 {
     if (!boss.active) return;
 
-    boss.x += boss.speed;
+    boss.prevX = boss.x;
+    boss.x += boss.speed * dt;
 
-    if (boss.x + boss.width > SCREEN_WIDTH || boss.x < 0) {
+    if (boss.x + BOSS_WIDTH > SCREEN_WIDTH || boss.x < 0) {
         boss.speed *= -1;
     }
 }
 
-void HandleBossShooting(Boss& boss, Bullet bossBullets[], int maxBossBullets, const GameResources& res)
-{
-    if (!boss.active) return;
-
-    boss.shootTimer -= GetFrameTime();
+// Boss bullet scripts, one per phase. Each phase ends in a PATTERN_JUMP
+// back to its own start.
+const PatternStep BOSS_PATTERN[] = {
+    // Phase 1: aimed triples between slow downward fans
+    { PATTERN_AIMED, 3, 0.25f, 300.0f, 0 },         // 0
+    { PATTERN_WAIT, 0, 0.4f, 0.0f, 0 },
+    { PATTERN_FAN, 5, 0.8f, 240.0f, 0 },
+    { PATTERN_WAIT, 0, 0.9f, 0.0f, 0 },
+    { PATTERN_JUMP, 0, 0.0f, 0.0f, 0 },
+    // Phase 2: a four-armed spiral, then an aimed burst
+    { PATTERN_RING, 4, 0.0f, 220.0f, 0 },           // 5
+    { PATTERN_SPIN, 0, 0.23f, 0.0f, 0 },
+    { PATTERN_WAIT, 0, 0.06f, 0.0f, 0 },
+    { PATTERN_LOOP, 40, 0.0f, 0.0f, 5 },
+    { PATTERN_AIMED, 7, 0.6f, 320.0f, 0 },
+    { PATTERN_WAIT, 0, 0.8f, 0.0f, 0 },
+    { PATTERN_JUMP, 0, 0.0f, 0.0f, 5 },
+    // Phase 3: dense spiral, a wave sweeping left and right, aimed bursts
+    { PATTERN_RING, 12, 0.0f, 240.0f, 0 },          // 12
+    { PATTERN_SPIN, 0, 0.13f, 0.0f, 0 },
+    { PATTERN_WAIT, 0, 0.05f, 0.0f, 0 },
+    { PATTERN_LOOP, 30, 0.0f, 0.0f, 12 },
+    { PATTERN_FACE, 0, -0.6f, 0.0f, 0 },
+    { PATTERN_FAN, 3, 0.2f, 280.0f, 0 },            // 17
+    { PATTERN_SPIN, 0, 0.08f, 0.0f, 0 },
+    { PATTERN_WAIT, 0, 0.04f, 0.0f, 0 },
+    { PATTERN_LOOP, 15, 0.0f, 0.0f, 17 },
+    { PATTERN_FAN, 3, 0.2f, 280.0f, 0 },            // 21
+    { PATTERN_SPIN, 0, -0.08f, 0.0f, 0 },
+    { PATTERN_WAIT, 0, 0.04f, 0.0f, 0 },
+    { PATTERN_LOOP, 15, 0.0f, 0.0f, 21 },
+    { PATTERN_AIMED, 5, 0.3f, 380.0f, 0 },          // 25
+    { PATTERN_WAIT, 0, 0.15f, 0.0f, 0 },
+    { PATTERN_LOOP, 4, 0.0f, 0.0f, 25 },
+    { PATTERN_WAIT, 0, 0.5f, 0.0f, 0 },
+    { PATTERN_JUMP, 0, 0.0f, 0.0f, 12 },
+};
+const int BOSS_PATTERN_LENGTH = sizeof(BOSS_PATTERN) / sizeof(BOSS_PATTERN[0]);
 
-    if (boss.shootTimer <= 0) {
-        PlaySound(res.shootSound);
+const BossPhase BOSS_PHASES[] = {
+    { 1.0f, 0 },
+    { 0.66f, 5 },
+    { 0.33f, 12 },
+};
+const int BOSS_PHASE_COUNT = sizeof(BOSS_PHASES) / sizeof(BOSS_PHASES[0]);
 
-        boss.shootTimer = 1.0f + (float)boss.health / BOSS_INITIAL_HEALTH * 0.5f;
-        if (boss.shootTimer < 0.3f) boss.shootTimer = 0.3f;
+void ResetBossPattern(Boss& boss)
+{
+    boss.shootTimer = 1.0f;
+    boss.phase = 0;
+    boss.pc = BOSS_PHASES[0].start;
+    boss.loopsLeft = 0;
+    boss.spin = 0.0f;
+}
 
-        int bulletsFired = 0;
-        for (int i = 0; i < maxBossBullets && bulletsFired < 3; i++) {
-            if (!bossBullets[i].active) {
-                bossBullets[i].active = true;
-                bossBullets[i].x = boss.x + boss.width / 2.0f - bossBullets[i].width / 2.0f;
-                bossBullets[i].y = boss.y + boss.height;
+// Picks the phase for the boss's remaining health. A new phase restarts
+// its script after a short pause, so transitions read clearly.
+void UpdateBossPhase(Boss& boss, int maxHealth)
+{
+    int phase = 0;
+    for (int i = 1; i < BOSS_PHASE_COUNT; i++) {
+        if (boss.health <= BOSS_PHASES[i].healthFraction * maxHealth) phase = i;
+    }
+    if (phase == boss.phase) return;
 
-                if (bulletsFired == 0) bossBullets[i].x -= 15;
-                if (bulletsFired == 2) bossBullets[i].x += 15;
+    boss.phase = phase;
+    boss.pc = BOSS_PHASES[phase].start;
+    boss.loopsLeft = 0;
+    boss.spin = 0.0f;
+    boss.shootTimer = BOSS_PHASE_PAUSE;
+}
 
-                bulletsFired++;
-            }
-        }
+// Fires count bullets from (x, y), centered there, at angles first,
+// first + step, ... Bullets that don't fit in the pool are dropped.
+void FireBossBullets(BossBulletPool& bossBullets, float x, float y, int count, float first, float step, float speed)
+{
+    float left = x - BOSS_BULLET_SIZE / 2.0f;
+    float top = y - BOSS_BULLET_SIZE / 2.0f;
+    for (int i = 0; i < count; i++) {
+        float angle = first + step * i;
+        if (!SpawnBossBullet(bossBullets, left, top, cosf(angle) * speed, sinf(angle) * speed)) return;
     }
 }
 
-void UpdateBossBullets(Bullet bossBullets[], int maxBossBullets)
+// Runs script steps until one waits. The wait carries over its remainder,
+// so patterns keep their rhythm at any tick rate.
+void RunBossPattern(Boss& boss, BossBulletPool& bossBullets, const Player& player, float dt, GameEvents& events)
 {
-    for (int i = 0; i < maxBossBullets; i++) {
-        if (bossBullets[i].active) {
-            bossBullets[i].y += bossBullets[i].speed;
-            if (bossBullets[i].y > SCREEN_HEIGHT) {
-                bossBullets[i].active = false;
+    const float DOWN = PI / 2.0f;
+    float x = boss.x + BOSS_WIDTH / 2.0f;
+    float y = boss.y + BOSS_HEIGHT / 2.0f;
+
+    boss.shootTimer -= dt;
+
+    int steps = 0;
+    for (; boss.shootTimer <= 0 && steps < MAX_PATTERN_STEPS_PER_TICK; steps++) {
+        const PatternStep& step = BOSS_PATTERN[boss.pc];
+        boss.pc++;
+
+        switch (step.op) {
+        case PATTERN_FAN:
+        case PATTERN_AIMED: {
+            float center = DOWN + boss.spin;
+            if (step.op == PATTERN_AIMED) {
+                center = atan2f(player.y + player.height / 2.0f - y, player.x + player.width / 2.0f - x);
             }
+            float spacing = step.count > 1 ? step.value / (step.count - 1) : 0.0f;
+            FireBossBullets(bossBullets, x, y, step.count, center - step.value / 2.0f, spacing, step.speed);
+            PushEvent(events, EVENT_BOSS_SHOT, x, y);
+            break;
+        }
+        case PATTERN_RING:
+            FireBossBullets(bossBullets, x, y, step.count, boss.spin, 2.0f * PI / step.count, step.speed);
+            PushEvent(events, EVENT_BOSS_SHOT, x, y);
+            break;
+        case PATTERN_SPIN:
+            boss.spin += step.value;
+            break;
+        case PATTERN_FACE:
+            boss.spin = step.value;
+            break;
+        case PATTERN_WAIT:
+            boss.shootTimer += step.value;
+            break;
+        case PATTERN_LOOP:
+            if (boss.loopsLeft == 0) boss.loopsLeft = step.count;
+            boss.loopsLeft--;
+            if (boss.loopsLeft > 0) boss.pc = step.target;
+            break;
+        case PATTERN_JUMP:
+            boss.pc = step.target;
+            break;
         }
     }
+
+    // Ran out of steps without a wait: start afresh next tick
+    if (steps == MAX_PATTERN_STEPS_PER_TICK && boss.shootTimer < 0) boss.shootTimer = 0;
 }
 
-// ---------------------------------------------------------
-// Collisions & lives
-// ---------------------------------------------------------
-bool RectanglesOverlap(float x1, float y1, int w1, int h1,
-    float x2, float y2, int w2, int h2)
+void HandleBossShooting(Boss& boss, BossBulletPool& bossBullets, const Player& player, int maxHealth, float dt,
+    GameEvents& events)
 {
-    if (x1 < x2 + w2 &&
-        x1 + w1 > x2 &&
-        y1 < y2 + h2 &&
-        y1 + h1 > y2) {
-        return true;
-    }
-    return false;
+    if (!boss.active) return;
+
+    UpdateBossPhase(boss, maxHealth);
+    RunBossPattern(boss, bossBullets, player, dt, events);
 }
 
-void CheckBulletEnemyCollisions(Bullet bullets[], int maxBullets,
-    Enemy enemies[], int enemyCount,
-    GameState& game, const GameResources& res)
+// Moves every boss bullet along its velocity and drops the ones that left
+// the screen
+void UpdateBossBullets(BossBulletPool& bossBullets, float dt)
 {
-    for (int i = 0; i < maxBullets; i++) {
-        if (!bullets[i].active) continue;
+    BossBulletColumns& c = bossBullets.cols;
+    int dropped = IntegrateAndMarkInside(c.x, c.y, c.prevX, c.prevY, c.vx, c.vy, bossBullets.count, dt,
+        (float)-BOSS_BULLET_SIZE, (float)SCREEN_WIDTH, (float)-BOSS_BULLET_SIZE, (float)SCREEN_HEIGHT, bossBullets.keep);
+    if (dropped > 0) PoolCompact(bossBullets, bossBullets.keep);
+}
 
-        for (int j = 0; j < enemyCount; j++) {
-            if (!enemies[j].active) continue;
+// ---------------------------------------------------------
+// Collisions & lives
+// ---------------------------------------------------------
+// Every test below is swept over the tick (SweptHitTime), so nothing
+// tunnels however fast it moves or however low the tick rate is.
+// Kills only drop health to zero; UpdateGame compacts them out afterwards
+// so the enemy grid stays valid for the rest of the tick.
+void CheckBulletEnemyCollisions(BulletPool& bullets, EnemyPool& enemies,
+    const SpatialGrid& enemyGrid, GameEvents& events)
+{
+    int* candidates = enemies.found;
+
+    int i = 0;
+    while (i < bullets.count) {
+        float dy = bullets.cols.y[i] - bullets.cols.prevY[i];
+        int found = QuerySweptBox(enemyGrid, bullets.cols.x[i], bullets.cols.y[i],
+            BULLET_WIDTH, BULLET_HEIGHT, 0.0f, dy, candidates, enemies.capacity);
+
+        // Enemies killed earlier this tick are still in the grid
+        int live = 0;
+        for (int k = 0; k < found; k++) {
+            candidates[live] = candidates[k];
+            live += enemies.cols.health[candidates[k]] > 0;
+        }
 
-            if (RectanglesOverlap(bullets[i].x, bullets[i].y,
-                bullets[i].width, bullets[i].height,
-                enemies[j].x, enemies[j].y,
-                enemies[j].width, enemies[j].height)) {
+        // Hit the live enemy the bullet reaches first (enemies never move sideways)
+        float hitTime;
+        int target = FirstHitInCandidates(bullets.cols.x[i], bullets.cols.y[i],
+            BULLET_WIDTH, BULLET_HEIGHT, 0.0f, dy,
+            enemies.cols.x, enemies.cols.y, enemies.cols.x, enemies.cols.prevY, ENEMY_WIDTH, ENEMY_HEIGHT,
+            candidates, live, hitTime);
 
-                bullets[i].active = false;
-                enemies[j].health--;
+        if (target < 0) {
+            i++;
+            continue;
+        }
 
-                PlaySound(res.explodeSound);
+        enemies.cols.health[target]--;
 
-                if (enemies[j].health <= 0) {
-                    enemies[j].active = false;
-                    game.score += 1;
-                    if (game.score > game.highScore) {
-                        game.highScore = game.score;
-                    }
-                }
-                break;
-            }
+        PushEvent(events, EVENT_ENEMY_HIT, enemies.cols.x[target], enemies.cols.y[target]);
+
+        if (enemies.cols.health[target] <= 0) {
+            PushEvent(events, EVENT_ENEMY_KILLED, enemies.cols.x[target], enemies.cols.y[target]);
         }
+
+        // A removed bullet is replaced by the last one, so re-test slot i
+        PoolReleaseAt(bullets, i);
     }
 }
 
-void CheckBulletBossCollisions(Bullet bullets[], int maxBullets,
-    Boss& boss, GameState& game, const GameResources& res)
+// At most one bullet hits the boss per tick: the one that reaches it
+// first. The boss stays active until ApplyGameEvents handles its defeat.
+void CheckBulletBossCollisions(BulletPool& bullets,
+    Boss& boss, GameEvents& events)
 {
     if (!boss.active) return;
 
-    for (int i = 0; i < maxBullets; i++) {
-        if (!bullets[i].active) continue;
-
-        if (RectanglesOverlap(bullets[i].x, bullets[i].y,
-            bullets[i].width, bullets[i].height,
-            boss.x, boss.y,
-            boss.width, boss.height)) {
+    int first = -1;
+    float firstTime = 0.0f;
+    for (int i = 0; i < bullets.count; i++) {
+        float time = SweptHitTime(bullets.cols.x[i], bullets.cols.y[i],
+            BULLET_WIDTH, BULLET_HEIGHT, 0.0f, bullets.cols.y[i] - bullets.cols.prevY[i],
+            boss.x, boss.y, BOSS_WIDTH, BOSS_HEIGHT, boss.x - boss.prevX, 0.0f);
+        if (time >= 0.0f && (first < 0 || time < firstTime)) {
+            first = i;
+            firstTime = time;
+        }
+    }
+    if (first < 0) return;
 
-            bullets[i].active = false;
-            boss.health--;
+    float hitX = bullets.cols.x[first];
+    float hitY = bullets.cols.y[first];
+    PoolReleaseAt(bullets, first);
+    boss.health--;
 
-            PlaySound(res.explodeSound);
+    PushEvent(events, EVENT_BOSS_HIT, hitX, hitY);
 
-            if (boss.health <= 0) {
-                boss.active = false;
-                game.score += 10;
-                game.gameWon = true;
-                game.gameState = STATE_WIN;
-                StopMusicStream(res.gameTheme);
-                PlaySound(res.winSound);
-            }
-            break;
-        }
+    if (boss.health <= 0) {
+        PushEvent(events, EVENT_BOSS_DEFEATED, boss.x, boss.y);
     }
 }
 
-bool CheckEnemyPlayerCollisions(const Enemy enemies[], int enemyCount,
-    const Player& player)
+bool CheckEnemyPlayerCollisions(const EnemyPool& enemies,
+    const SpatialGrid& enemyGrid, const Player& player)
 {
     if (!player.isAlive) return false;
 
-    for (int i = 0; i < enemyCount; i++) {
-        if (!enemies[i].active) continue;
+    float dx = player.x - player.prevX;
+    float dy = player.y - player.prevY;
+    int* candidates = enemies.found;
+    int found = QuerySweptBox(enemyGrid, player.x, player.y,
+        (float)player.width, (float)player.height, dx, dy, candidates, enemies.capacity);
 
-        if (RectanglesOverlap(player.x, player.y,
-            player.width, player.height,
-            enemies[i].x, enemies[i].y,
-            enemies[i].width, enemies[i].height)) {
-            return true;
-        }
+    int live = 0;
+    for (int k = 0; k < found; k++) {
+        candidates[live] = candidates[k];
+        live += enemies.cols.health[candidates[k]] > 0;
     }
-    return false;
+
+    float hitTime;
+    return FirstHitInCandidates(player.x, player.y,
+        (float)player.width, (float)player.height, dx, dy,
+        enemies.cols.x, enemies.cols.y, enemies.cols.x, enemies.cols.prevY, ENEMY_WIDTH, ENEMY_HEIGHT,
+        candidates, live, hitTime) >= 0;
 }
 
 bool CheckBossPlayerCollision(const Boss& boss, const Player& player)
 {
     if (!boss.active || !player.isAlive) return false;
 
-    return RectanglesOverlap(player.x, player.y,
-        player.width, player.height,
-        boss.x, boss.y,
-        boss.width, boss.height);
+    return SweptHitTime(player.x, player.y,
+        (float)player.width, (float)player.height, player.x - player.prevX, player.y - player.prevY,
+        boss.x, boss.y, BOSS_WIDTH, BOSS_HEIGHT, boss.x - boss.prevX, 0.0f) >= 0.0f;
 }
 
-bool CheckBossBulletPlayerCollisions(const Bullet bossBullets[], int maxBossBullets,
-    const Player& player)
+bool CheckBossBulletPlayerCollisions(BossBulletPool& bossBullets,
+    const SpatialGrid& bossBulletGrid, const Player& player)
 {
     if (!player.isAlive) return false;
 
-    for (int i = 0; i < maxBossBullets; i++) {
-        if (!bossBullets[i].active) continue;
+    float dx = player.x - player.prevX;
+    float dy = player.y - player.prevY;
+    int* candidates = bossBullets.found;
+    int found = QuerySweptBox(bossBulletGrid, player.x, player.y,
+        (float)player.width, (float)player.height, dx, dy, candidates, bossBullets.capacity);
 
-        if (RectanglesOverlap(player.x, player.y,
-            player.width, player.height,
-            bossBullets[i].x, bossBullets[i].y,
-            bossBullets[i].width, bossBullets[i].height)) {
+    float hitTime;
+    int target = FirstHitInCandidates(player.x, player.y,
+        (float)player.width, (float)player.height, dx, dy,
+        bossBullets.cols.x, bossBullets.cols.y, bossBullets.cols.prevX, bossBullets.cols.prevY,
+        BOSS_BULLET_SIZE, BOSS_BULLET_SIZE, candidates, found, hitTime);
 
-            
-            ((Bullet*)bossBullets)[i].active = false;
-            return true;
-        }
-    }
-    return false;
+    if (target < 0) return false;
+
+    PoolReleaseAt(bossBullets, target);
+    return true;
 }
 
 
-void HandlePlayerHit(GameState& game, Player& player,
-    Enemy enemies[], int& enemyCount,
-    Bullet bullets[], int maxBullets,
-    Boss& boss, Bullet bossBullets[], int maxBossBullets, const GameResources& res)
+// Takes a life and resets the playfield. Returns true when that was the
+// last life and the game is over.
+bool HandlePlayerHit(GameState& game, Player& player, Player& partner,
+    EnemyPool& enemies, BulletPool& bullets,
+    Boss& boss, BossBulletPool& bossBullets)
 {
     player.lives--;
-    if (player.lives > 0) {
-        PlaySound(res.playerHitSound);
-    }
     if (player.lives <= 0) {
-        StopMusicStream(res.gameTheme);
-        PlaySound(res.gameOverSound);
         player.isAlive = false;
+        partner.isAlive = false;
         game.gameOver = true;
         game.gameState = STATE_GAME_OVER;
-        return;
+        return true;
     }
 
     // Reset player position
     player.isAlive = true;
     player.x = SCREEN_WIDTH / 2.0f - player.width / 2.0f;
     player.y = SCREEN_HEIGHT - 60.0f;
-
-    // Clear player bullets
-    for (int i = 0; i < maxBullets; i++) {
-        bullets[i].active = false;
+    player.prevX = player.x;
+    player.prevY = player.y;
+    if (partner.isAlive) {
+        InitPartner(partner);
     }
 
-    // Clear boss bullets
-    for (int i = 0; i < maxBossBullets; i++) {
-        bossBullets[i].active = false;
-    }
+    // Clear player and boss bullets
+    PoolClear(bullets);
+    PoolClear(bossBullets);
 
 
     if (game.gameState == STATE_PLAYING) {
-        InitEnemiesForLevel(game, enemies, enemyCount);
+        InitEnemiesForLevel(game, enemies);
     }
     else if (game.gameState == STATE_BOSS_FIGHT) {
       
-        boss.x = SCREEN_WIDTH / 2.0f - boss.width / 2.0f;
+        boss.x = SCREEN_WIDTH / 2.0f - BOSS_WIDTH / 2.0f;
         boss.y = 50.0f;
+        boss.prevX = boss.x;
         boss.shootTimer = 1.0f; // Reset shoot timer
     }
+    return false;
+}
+
+// Drains the tick's queue in push order, applying what the collision passes
+// recorded. A hit reported after the game already ended this tick (the
+// boss died first) no longer counts and is dropped, so the frontend only
+// hears about what happened; a hit that costs the last life is reported
+// as the game over.
+void ApplyGameEvents(GameState& game, Player& player, Player& partner,
+    EnemyPool& enemies, BulletPool& bullets,
+    Boss& boss, BossBulletPool& bossBullets, GameEvents& events)
+{
+    int kept = 0;
+    for (int i = 0; i < events.count; i++) {
+        GameEvent e = events.items[i];
+
+        if (e.type == EVENT_ENEMY_KILLED) {
+            game.score += 1;
+            if (game.score > game.highScore) {
+                game.highScore = game.score;
+            }
+        }
+        else if (e.type == EVENT_BOSS_DEFEATED) {
+            boss.active = false;
+            game.score += 10;
+            game.gameWon = true;
+            game.gameState = STATE_WIN;
+        }
+        else if (e.type == EVENT_PLAYER_HIT) {
+            if (game.gameState != STATE_PLAYING && game.gameState != STATE_BOSS_FIGHT) continue;
+            if (HandlePlayerHit(game, player, partner, enemies, bullets, boss, bossBullets)) {
+                e.type = EVENT_GAME_OVER;
+            }
+        }
+
+        events.items[kept++] = e;
+    }
+    events.count = kept;
 }
 // ---------------------------------------------------------
 // HUD, scoring, level progression
 // ---------------------------------------------------------
-void DrawHUD(const GameState& game, const Player& player, const Boss& boss)
+// Each line is re-rendered only when its value changes
+void DrawHUD(RenderCache& cache, const GameState& game, const Player& player, const Boss& boss)
 {
-    DrawText(TextFormat("Score: %d", game.score),
-        10, 10, 20, RAYWHITE);
+    DrawCachedText(cache, HUD_SCORE, game.score, "Score: %d",
+        10, 10, RAYWHITE);
 
+    // The boss fight shows as level 0, which is never a real level
     if (game.gameState == STATE_BOSS_FIGHT) {
-        DrawText("Level: BOSS", 10, 35, 20, RED);
+        DrawCachedText(cache, HUD_LEVEL, 0, "Level: BOSS", 10, 35, RED);
     }
     else {
-        DrawText(TextFormat("Level: %d", game.level),
-            10, 35, 20, RAYWHITE);
+        DrawCachedText(cache, HUD_LEVEL, game.level, "Level: %d",
+            10, 35, RAYWHITE);
     }
 
-    DrawText(TextFormat("Lives: %d", player.lives),
-        10, 60, 20, RAYWHITE);
+    DrawCachedText(cache, HUD_LIVES, player.lives, "Lives: %d",
+        10, 60, RAYWHITE);
 
-    DrawText(TextFormat("Best: %d", game.highScore),
-        SCREEN_WIDTH - 180, 10, 20, GREEN);
+    DrawCachedText(cache, HUD_BEST, game.highScore, "Best: %d",
+        SCREEN_WIDTH - 180, 10, GREEN);
 
     if (boss.active) {
-        DrawText(TextFormat("BOSS HEALTH: %d", boss.health),
-            SCREEN_WIDTH / 2 - 100, 10, 20, RED);
+        DrawCachedText(cache, HUD_BOSS_HEALTH, boss.health, "BOSS HEALTH: %d",
+            SCREEN_WIDTH / 2 - 100, 10, RED);
     }
 }
 
 void UpdateScoreAndLevel(GameState& game, Player& player,
-    Enemy enemies[], int& enemyCount,
-    Bullet bullets[], int maxBullets,
-    Boss& boss, Bullet bossBullets[], int maxBossBullets, const GameResources& res)
+    EnemyPool& enemies, BulletPool& bullets,
+    Boss& boss, BossBulletPool& bossBullets, Arena& arena)
 {
-    bool allDead = AreAllEnemiesDestroyed(enemies, enemyCount);
+    bool allDead = AreAllEnemiesDestroyed(enemies);
 
-    if (game.score >= game.level * 10 && game.gameState == STATE_PLAYING) {
+    if (game.score >= game.level * game.balance.scorePerLevel && game.gameState == STATE_PLAYING) {
         game.level++;
 
         if (game.level > MAX_LEVEL) {
             game.hitsToKill = 1;
-            InitBoss(boss);
+            InitBoss(boss, game.balance.bossHealth);
             boss.active = true;
             game.bossActive = true;
             game.gameState = STATE_BOSS_FIGHT;
         }
         else {
             game.hitsToKill = 1;
-            ResetLevel(game, player, enemies, enemyCount, bullets, maxBullets, boss, bossBullets, maxBossBullets);
+            ResetLevel(game, player, enemies, bullets, boss, bossBullets, arena);
         }
     }
     else if (allDead && game.gameState == STATE_PLAYING) {
-        game.hitsToKill++;
-        InitEnemiesForLevel(game, enemies, enemyCount);
+        game.hitsToKill += game.balance.hitsPerWave;
+        InitEnemiesForLevel(game, enemies);
     }
 }
 
 void ResetLevel(GameState& game, Player& player,
-    Enemy enemies[], int& enemyCount,
-    Bullet bullets[], int maxBullets,
-    Boss& boss, Bullet bossBullets[], int maxBossBullets)
+    EnemyPool& enemies, BulletPool& bullets,
+    Boss& boss, BossBulletPool& bossBullets, Arena& arena)
 {
-    for (int i = 0; i < maxBullets; i++) {
-        bullets[i].active = false;
-    }
-
-    for (int i = 0; i < MAX_BOSS_BULLETS; i++) {
-        bossBullets[i].active = false;
-    }
-    InitBoss(boss);
+    ResetLevelArena(arena, enemies, bullets, bossBullets);
+    InitBoss(boss, game.balance.bossHealth);
 
-    InitEnemiesForLevel(game, enemies, enemyCount);
+    InitEnemiesForLevel(game, enemies);
 
     player.x = SCREEN_WIDTH / 2.0f - player.width / 2.0f;
     player.y = SCREEN_HEIGHT - 60.0f;
+    player.prevX = player.x;
+    player.prevY = player.y;
     player.isAlive = true;
 }
 
 void ResetGameToLevel1(GameState& game, Player& player,
-    Enemy enemies[], int& enemyCount,
-    Bullet bullets[], int maxBullets,
-    Boss& boss, Bullet bossBullets[], int maxBossBullets)
+    EnemyPool& enemies, BulletPool& bullets,
+    Boss& boss, BossBulletPool& bossBullets, Arena& arena)
 {
     game.score = 0;
     game.level = 1;
@@ -1067,38 +6294,307 @@ void ResetGameToLevel1(GameState& game, Player& player,
     game.bossActive = false;
 
     InitPlayer(player);
-    InitBullets(bullets, maxBullets);
-    InitEnemiesForLevel(game, enemies, enemyCount);
-    InitBoss(boss);
-    InitBossBullets(bossBullets, maxBossBullets);
+    ResetLevelArena(arena, enemies, bullets, bossBullets);
+    InitEnemiesForLevel(game, enemies);
+    InitBoss(boss, game.balance.bossHealth);
 }
 
-void SaveGame(const GameState& game, const Player& player, const Boss& boss)
+// Largest snapshot the pools can produce: every pool full
+int SnapshotMaxBytes(const EnemyPool& enemies, const BulletPool& bullets, const BossBulletPool& bossBullets)
 {
-    ofstream file("savegame.txt");
-    if (!file.is_open()) {
+    return SNAPSHOT_HEADER_BYTES + 4 * (SNAPSHOT_FIXED_FIELDS + 5 * enemies.capacity
+        + 3 * bullets.capacity + 6 * bossBullets.capacity);
+}
+
+// Snapshot fields are written in host byte order (little-endian on every
+// platform we ship). Every field is 4 bytes wide, bools included.
+unsigned int SnapshotChecksum(const unsigned char* data, int size)
+{
+    // FNV-1a over 32-bit words; size is always a multiple of 4
+    unsigned int hash = 2166136261u;
+    for (int i = 0; i < size; i += 4) {
+        unsigned int word;
+        memcpy(&word, data + i, 4);
+        hash = (hash ^ word) * 16777619u;
+    }
+    return hash;
+}
+
+void PutSnapshotInt(unsigned char*& p, int value)
+{
+    memcpy(p, &value, 4);
+    p += 4;
+}
+
+void PutSnapshotFloats(unsigned char*& p, const float values[], int count)
+{
+    memcpy(p, values, 4 * (size_t)count);
+    p += 4 * (size_t)count;
+}
+
+void PutSnapshotInts(unsigned char*& p, const int values[], int count)
+{
+    memcpy(p, values, 4 * (size_t)count);
+    p += 4 * (size_t)count;
+}
+
+int GetSnapshotInt(const unsigned char*& p)
+{
+    int value;
+    memcpy(&value, p, 4);
+    p += 4;
+    return value;
+}
+
+void GetSnapshotFloats(const unsigned char*& p, float values[], int count)
+{
+    memcpy(values, p, 4 * (size_t)count);
+    p += 4 * (size_t)count;
+}
+
+void GetSnapshotInts(const unsigned char*& p, int values[], int count)
+{
+    memcpy(values, p, 4 * (size_t)count);
+    p += 4 * (size_t)count;
+}
+
+// Writes the whole simulation state (the broadphase grids are rebuilt every
+// tick, so they are not saved). Layout after the header:
+//   enemy, bullet and boss bullet counts
+//   GameState, Player, Boss fields in declaration order (each RNG stream
+//   as state and inc, low 32 bits first)
+//   enemy columns x, y, prevY, speed, health; bullet columns x, y, prevY;
+//   boss bullet columns x, y, prevX, prevY, vx, vy
+// Returns the snapshot size in bytes, or 0 if capacity is too small.
+int SerializeSnapshot(const GameState& game, const Player& player,
+    const EnemyPool& enemies, const BulletPool& bullets,
+    const Boss& boss, const BossBulletPool& bossBullets,
+    unsigned char* out, int capacity)
+{
+    int payload = 4 * (SNAPSHOT_FIXED_FIELDS + 5 * enemies.count + 3 * bullets.count + 6 * bossBullets.count);
+    if (SNAPSHOT_HEADER_BYTES + payload > capacity) return 0;
+
+    unsigned char* p = out + SNAPSHOT_HEADER_BYTES;
+
+    PutSnapshotInt(p, enemies.count);
+    PutSnapshotInt(p, bullets.count);
+    PutSnapshotInt(p, bossBullets.count);
+
+    PutSnapshotInt(p, game.score);
+    PutSnapshotInt(p, game.level);
+    PutSnapshotInt(p, game.highScore);
+    PutSnapshotInt(p, game.hitsToKill);
+    PutSnapshotInt(p, game.gameOver);
+    PutSnapshotInt(p, game.gameWon);
+    PutSnapshotInt(p, game.gameState);
+    PutSnapshotInt(p, game.bossActive);
+    PutSnapshotInt(p, (int)game.seed);
+    for (int i = 0; i < RNG_STREAM_COUNT; i++) {
+        PutSnapshotInt(p, (int)(unsigned int)game.rng[i].state);
+        PutSnapshotInt(p, (int)(unsigned int)(game.rng[i].state >> 32));
+        PutSnapshotInt(p, (int)(unsigned int)game.rng[i].inc);
+        PutSnapshotInt(p, (int)(unsigned int)(game.rng[i].inc >> 32));
+    }
+
+    PutSnapshotFloats(p, &player.x, 1);
+    PutSnapshotFloats(p, &player.y, 1);
+    PutSnapshotFloats(p, &player.prevX, 1);
+    PutSnapshotFloats(p, &player.prevY, 1);
+    PutSnapshotInt(p, player.width);
+    PutSnapshotInt(p, player.height);
+    PutSnapshotFloats(p, &player.speed, 1);
+    PutSnapshotInt(p, player.lives);
+    PutSnapshotInt(p, player.isAlive);
+
+    PutSnapshotFloats(p, &boss.x, 1);
+    PutSnapshotFloats(p, &boss.y, 1);
+    PutSnapshotFloats(p, &boss.prevX, 1);
+    PutSnapshotFloats(p, &boss.speed, 1);
+    PutSnapshotInt(p, boss.health);
+    PutSnapshotInt(p, boss.active);
+    PutSnapshotFloats(p, &boss.shootTimer, 1);
+    PutSnapshotInt(p, boss.phase);
+    PutSnapshotInt(p, boss.pc);
+    PutSnapshotInt(p, boss.loopsLeft);
+    PutSnapshotFloats(p, &boss.spin, 1);
+
+    PutSnapshotFloats(p, enemies.cols.x, enemies.count);
+    PutSnapshotFloats(p, enemies.cols.y, enemies.count);
+    PutSnapshotFloats(p, enemies.cols.prevY, enemies.count);
+    PutSnapshotFloats(p, enemies.cols.speed, enemies.count);
+    PutSnapshotInts(p, enemies.cols.health, enemies.count);
+
+    PutSnapshotFloats(p, bullets.cols.x, bullets.count);
+    PutSnapshotFloats(p, bullets.cols.y, bullets.count);
+    PutSnapshotFloats(p, bullets.cols.prevY, bullets.count);
+
+    PutSnapshotFloats(p, bossBullets.cols.x, bossBullets.count);
+    PutSnapshotFloats(p, bossBullets.cols.y, bossBullets.count);
+    PutSnapshotFloats(p, bossBullets.cols.prevX, bossBullets.count);
+    PutSnapshotFloats(p, bossBullets.cols.prevY, bossBullets.count);
+    PutSnapshotFloats(p, bossBullets.cols.vx, bossBullets.count);
+    PutSnapshotFloats(p, bossBullets.cols.vy, bossBullets.count);
+
+    unsigned char* h = out;
+    PutSnapshotInt(h, (int)SNAPSHOT_MAGIC);
+    PutSnapshotInt(h, (int)SNAPSHOT_VERSION);
+    PutSnapshotInt(h, payload);
+    PutSnapshotInt(h, (int)SnapshotChecksum(out + SNAPSHOT_HEADER_BYTES, payload));
+
+    return SNAPSHOT_HEADER_BYTES + payload;
+}
+
+// Validates the header, checksum and counts before touching any state, so
+// a rejected snapshot leaves the game as it was.
+bool DeserializeSnapshot(const unsigned char* data, int size,
+    GameState& game, Player& player, EnemyPool& enemies, BulletPool& bullets,
+    Boss& boss, BossBulletPool& bossBullets)
+{
+    if (size < SNAPSHOT_HEADER_BYTES + 4 * SNAPSHOT_FIXED_FIELDS) return false;
+
+    const unsigned char* p = data;
+    unsigned int magic = (unsigned int)GetSnapshotInt(p);
+    unsigned int version = (unsigned int)GetSnapshotInt(p);
+    int payload = GetSnapshotInt(p);
+    unsigned int checksum = (unsigned int)GetSnapshotInt(p);
+
+    if (magic != SNAPSHOT_MAGIC || version != SNAPSHOT_VERSION) return false;
+    if (payload != size - SNAPSHOT_HEADER_BYTES) return false;
+    if (SnapshotChecksum(p, payload) != checksum) return false;
+
+    int enemyCount = GetSnapshotInt(p);
+    int bulletCount = GetSnapshotInt(p);
+    int bossBulletCount = GetSnapshotInt(p);
+    if (enemyCount < 0 || enemyCount > enemies.capacity) return false;
+    if (bulletCount < 0 || bulletCount > bullets.capacity) return false;
+    if (bossBulletCount < 0 || bossBulletCount > bossBullets.capacity) return false;
+    if (payload != 4 * (SNAPSHOT_FIXED_FIELDS + 5 * enemyCount + 3 * bulletCount + 6 * bossBulletCount)) return false;
+
+    game.score = GetSnapshotInt(p);
+    game.level = GetSnapshotInt(p);
+    game.highScore = GetSnapshotInt(p);
+    game.hitsToKill = GetSnapshotInt(p);
+    game.gameOver = GetSnapshotInt(p) != 0;
+    game.gameWon = GetSnapshotInt(p) != 0;
+    int state = GetSnapshotInt(p);
+    game.gameState = state >= STATE_MENU && state <= STATE_BOSS_FIGHT ? (GameStateEnum)state : STATE_MENU;
+    game.bossActive = GetSnapshotInt(p) != 0;
+    game.seed = (unsigned int)GetSnapshotInt(p);
+    for (int i = 0; i < RNG_STREAM_COUNT; i++) {
+        unsigned long long lo = (unsigned int)GetSnapshotInt(p);
+        game.rng[i].state = lo | (unsigned long long)(unsigned int)GetSnapshotInt(p) << 32;
+        lo = (unsigned int)GetSnapshotInt(p);
+        game.rng[i].inc = lo | (unsigned long long)(unsigned int)GetSnapshotInt(p) << 32;
+    }
+
+    GetSnapshotFloats(p, &player.x, 1);
+    GetSnapshotFloats(p, &player.y, 1);
+    GetSnapshotFloats(p, &player.prevX, 1);
+    GetSnapshotFloats(p, &player.prevY, 1);
+    player.width = GetSnapshotInt(p);
+    player.height = GetSnapshotInt(p);
+    GetSnapshotFloats(p, &player.speed, 1);
+    player.lives = GetSnapshotInt(p);
+    player.isAlive = GetSnapshotInt(p) != 0;
+
+    GetSnapshotFloats(p, &boss.x, 1);
+    GetSnapshotFloats(p, &boss.y, 1);
+    GetSnapshotFloats(p, &boss.prevX, 1);
+    GetSnapshotFloats(p, &boss.speed, 1);
+    boss.health = GetSnapshotInt(p);
+    boss.active = GetSnapshotInt(p) != 0;
+    GetSnapshotFloats(p, &boss.shootTimer, 1);
+    boss.phase = GetSnapshotInt(p);
+    boss.pc = GetSnapshotInt(p);
+    boss.loopsLeft = GetSnapshotInt(p);
+    GetSnapshotFloats(p, &boss.spin, 1);
+    // The script indexes tables, so a bad position restarts it instead
+    if (boss.phase < 0 || boss.phase >= BOSS_PHASE_COUNT || boss.pc < 0 || boss.pc >= BOSS_PATTERN_LENGTH
+        || boss.loopsLeft < 0) {
+        ResetBossPattern(boss);
+    }
+
+    // Pools are refilled in order, so dense indices match the saved ones
+    PoolClear(enemies);
+    for (int i = 0; i < enemyCount; i++) PoolAcquire(enemies);
+    GetSnapshotFloats(p, enemies.cols.x, enemyCount);
+    GetSnapshotFloats(p, enemies.cols.y, enemyCount);
+    GetSnapshotFloats(p, enemies.cols.prevY, enemyCount);
+    GetSnapshotFloats(p, enemies.cols.speed, enemyCount);
+    GetSnapshotInts(p, enemies.cols.health, enemyCount);
+
+    PoolClear(bullets);
+    for (int i = 0; i < bulletCount; i++) PoolAcquire(bullets);
+    GetSnapshotFloats(p, bullets.cols.x, bulletCount);
+    GetSnapshotFloats(p, bullets.cols.y, bulletCount);
+    GetSnapshotFloats(p, bullets.cols.prevY, bulletCount);
+
+    PoolClear(bossBullets);
+    for (int i = 0; i < bossBulletCount; i++) PoolAcquire(bossBullets);
+    GetSnapshotFloats(p, bossBullets.cols.x, bossBulletCount);
+    GetSnapshotFloats(p, bossBullets.cols.y, bossBulletCount);
+    GetSnapshotFloats(p, bossBullets.cols.prevX, bossBulletCount);
+    GetSnapshotFloats(p, bossBullets.cols.prevY, bossBulletCount);
+    GetSnapshotFloats(p, bossBullets.cols.vx, bossBulletCount);
+    GetSnapshotFloats(p, bossBullets.cols.vy, bossBulletCount);
+
+    return true;
+}
+
+void SaveGame(const GameState& game, const Player& player,
+    const EnemyPool& enemies, const BulletPool& bullets,
+    const Boss& boss, const BossBulletPool& bossBullets)
+{
+    static vector<unsigned char> buffer;
+    buffer.resize(SnapshotMaxBytes(enemies, bullets, bossBullets));
+    int size = SerializeSnapshot(game, player, enemies, bullets, boss, bossBullets, buffer.data(), (int)buffer.size());
+    if (size == 0) {
         return;
     }
 
-    file << game.score << ' '
-        << game.level << ' '
-        << game.highScore << ' '
-        << game.hitsToKill << ' '
-        << player.lives << ' '
-        << game.bossActive << '\n';
+    ofstream file("savegame.bin", ios::binary);
+    if (!file.is_open()) {
+        return;
+    }
 
+    file.write((const char*)buffer.data(), size);
     file.close();
 }
 
-void LoadGame(GameState& game, Player& player, Boss& boss)
+// Restores savegame.bin if it is a valid snapshot (returns true); otherwise
+// falls back to the old savegame.txt, which only keeps the score fields.
+bool LoadGame(GameState& game, Player& player,
+    EnemyPool& enemies, BulletPool& bullets,
+    Boss& boss, BossBulletPool& bossBullets)
+{
+    static vector<unsigned char> buffer;
+    buffer.resize(SnapshotMaxBytes(enemies, bullets, bossBullets));
+
+    ifstream file("savegame.bin", ios::binary);
+    if (file.is_open()) {
+        file.read((char*)buffer.data(), (streamsize)buffer.size());
+        int size = (int)file.gcount();
+        file.close();
+
+        if (DeserializeSnapshot(buffer.data(), size, game, player, enemies, bullets, boss, bossBullets)) {
+            return true;
+        }
+    }
+
+    LoadLegacyGame(game, player, boss);
+    return false;
+}
+
+bool LoadLegacyGame(GameState& game, Player& player, Boss& boss)
 {
     ifstream file("savegame.txt");
     if (!file.is_open()) {
-        return;
+        return false;
     }
 
     int score, level, highScore, hitsToKill, lives;
     int bossActiveInt = 0;
+    bool loaded = false;
 
     if (file >> score >> level >> highScore >> hitsToKill >> lives >> bossActiveInt) {
         game.score = score;
@@ -1114,9 +6610,298 @@ void LoadGame(GameState& game, Player& player, Boss& boss)
 
         if (game.bossActive) {
             game.gameState = STATE_BOSS_FIGHT;
-            InitBoss(boss);
+            InitBoss(boss, game.balance.bossHealth);
         }
+        loaded = true;
     }
 
     file.close();
-}
\ No newline at end of file
+    return loaded;
+}
+
+#if defined(SPACE_BENCHMARK)
+// ---------------------------------------------------------
+// Microbenchmarks (Benchmark build only)
+// ---------------------------------------------------------
+
+// Every global allocation is counted so a benchmark can report allocs/call
+atomic<long long> allocationCount(0);
+
+void* operator new(size_t size)
+{
+    allocationCount++;
+    void* p = malloc(size > 0 ? size : 1);
+    if (p == NULL) throw bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+unsigned long long ReadCycleCounter()
+{
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// Enemies and bullets are scattered over a side x side square
+void BenchSpawnEnemies(BenchContext& ctx, int count, float side)
+{
+    EnemyPool& enemies = ctx.world.enemies;
+    PoolInit(enemies);
+    for (int n = 0; n < count; n++) {
+        int i = PoolAcquire(enemies);
+        enemies.cols.x[i] = (float)RngRange(ctx.rng, 0, (int)side);
+        enemies.cols.y[i] = (float)RngRange(ctx.rng, 0, (int)side);
+        enemies.cols.prevY[i] = enemies.cols.y[i];
+        enemies.cols.speed[i] = (float)RngRange(ctx.rng, 60, 160);
+        enemies.cols.health[i] = 1;
+    }
+}
+
+void BenchSpawnBullets(BenchContext& ctx, int count, float side, float maxY)
+{
+    BulletPool& bullets = ctx.world.bullets;
+    PoolInit(bullets);
+    for (int n = 0; n < count; n++) {
+        SpawnBullet(bullets, (float)RngRange(ctx.rng, 0, (int)side), (float)RngRange(ctx.rng, 0, (int)maxY));
+    }
+}
+
+void SetupUpdateEnemies(BenchContext& ctx, int entities)
+{
+    BenchSpawnEnemies(ctx, entities, sqrtf(entities * BENCH_AREA_PER_ENTITY));
+    ctx.entities = entities;
+}
+
+void RunUpdateEnemies(BenchContext& ctx)
+{
+    UpdateEnemies(ctx.world.enemies, 1.0f / DEFAULT_TICK_RATE);
+}
+
+// Bullets stay on screen vertically so only the few near the top get culled
+void SetupUpdateBullets(BenchContext& ctx, int entities)
+{
+    BenchSpawnBullets(ctx, entities, sqrtf(entities * BENCH_AREA_PER_ENTITY), (float)SCREEN_HEIGHT);
+    ctx.entities = entities;
+}
+
+void RunUpdateBullets(BenchContext& ctx)
+{
+    UpdateBullets(ctx.world.bullets, 1.0f / DEFAULT_TICK_RATE);
+}
+
+// entities enemies and entities bullets in the same area, grid prebuilt
+void SetupBulletEnemyCollisions(BenchContext& ctx, int entities)
+{
+    float side = sqrtf(entities * BENCH_AREA_PER_ENTITY);
+    BenchSpawnEnemies(ctx, entities, side);
+    BenchSpawnBullets(ctx, entities, side, side);
+    InitSpatialGrid(ctx.enemyGrid, 0, 0, side, side, GRID_CELL_SIZE);
+    BuildSpatialGrid(ctx.enemyGrid, ctx.world.enemies.cols.x, ctx.world.enemies.cols.y, ctx.world.enemies.count);
+    ctx.events.count = 0;
+    ctx.entities = entities;
+}
+
+void RunBuildEnemyGrid(BenchContext& ctx)
+{
+    const EnemyPool& enemies = ctx.world.enemies;
+    BuildSpatialGrid(ctx.enemyGrid, enemies.cols.x, enemies.cols.y, enemies.count);
+}
+
+void RunBulletEnemyCollisions(BenchContext& ctx)
+{
+    CheckBulletEnemyCollisions(ctx.world.bullets, ctx.world.enemies, ctx.enemyGrid, ctx.events);
+}
+
+// Waves grow by three enemies per level, so pick the level closest to the
+// requested count
+void SetupInitEnemiesForLevel(BenchContext& ctx, int entities)
+{
+    GameState& game = ctx.world.game;
+    game.level = entities > 3 ? (entities - 3) / 3 : 1;
+    game.hitsToKill = 1;
+    PoolInit(ctx.world.enemies);
+    int capacity = ctx.world.enemies.capacity;
+    ctx.entities = 3 + game.level * 3 < capacity ? 3 + game.level * 3 : capacity;
+}
+
+void RunInitEnemiesForLevel(BenchContext& ctx)
+{
+    InitEnemiesForLevel(ctx.world.game, ctx.world.enemies);
+}
+
+// Mid-wave tick: nothing to advance, the common case
+void SetupScoreSteady(BenchContext& ctx, int entities)
+{
+    SetupUpdateEnemies(ctx, entities);
+    GameState& game = ctx.world.game;
+    game.level = 1;
+    game.score = 0;
+    game.gameState = STATE_PLAYING;
+}
+
+// Wave just cleared below the score threshold: a new wave is spawned
+void SetupScoreWaveCleared(BenchContext& ctx, int entities)
+{
+    SetupInitEnemiesForLevel(ctx, entities);
+    GameState& game = ctx.world.game;
+    game.score = 0;
+    game.gameState = STATE_PLAYING;
+}
+
+void RunUpdateScoreAndLevel(BenchContext& ctx)
+{
+    GameWorld& w = ctx.world;
+    UpdateScoreAndLevel(w.game, w.player, w.enemies, w.bullets, w.boss, w.bossBullets, w.arena);
+}
+
+void RunSerializeSnapshot(BenchContext& ctx)
+{
+    GameWorld& w = ctx.world;
+    ctx.snapshotSize = SerializeSnapshot(w.game, w.player, w.enemies, w.bullets, w.boss, w.bossBullets,
+        ctx.snapshot.data(), (int)ctx.snapshot.size());
+}
+
+// Snapshots hold entities enemies, bullets and boss bullets, as in a boss
+// fight mid-volley. The setup checks that one loads back and serializes to
+// the same bytes.
+void SetupSnapshot(BenchContext& ctx, int entities)
+{
+    SetupBulletEnemyCollisions(ctx, entities);
+    GameWorld& w = ctx.world;
+    PoolInit(w.bossBullets);
+    FireBossBullets(w.bossBullets, SCREEN_WIDTH / 2.0f, SCREEN_HEIGHT / 2.0f, entities, 0.0f, 2.0f * PI / entities, 240.0f);
+    w.boss.active = true;
+    w.game.gameState = STATE_BOSS_FIGHT;
+    RunSerializeSnapshot(ctx);
+
+    static vector<unsigned char> copy;
+    copy.assign(ctx.snapshot.begin(), ctx.snapshot.begin() + ctx.snapshotSize);
+    bool loaded = DeserializeSnapshot(copy.data(), (int)copy.size(),
+        w.game, w.player, w.enemies, w.bullets, w.boss, w.bossBullets);
+    RunSerializeSnapshot(ctx);
+    if (!loaded || ctx.snapshotSize != (int)copy.size() || memcmp(copy.data(), ctx.snapshot.data(), copy.size()) != 0) {
+        cout << "# snapshot round trip failed at " << entities << '\n';
+    }
+}
+
+void RunDeserializeSnapshot(BenchContext& ctx)
+{
+    GameWorld& w = ctx.world;
+    DeserializeSnapshot(ctx.snapshot.data(), ctx.snapshotSize, w.game, w.player, w.enemies, w.bullets, w.boss, w.bossBullets);
+}
+
+// One in eight particles expires this step, so the cull pass has work too
+void SetupUpdateParticles(BenchContext& ctx, int entities)
+{
+    ParticleSystem& ps = ctx.particles;
+    InitParticles(ps, BENCH_SEED);
+    EmitParticles(ps, SCREEN_WIDTH / 2.0f, SCREEN_HEIGHT / 2.0f, entities, 0.0f, 2.0f * PI,
+        20.0f, 400.0f, 2.0f, 4.0f, ORANGE);
+    for (int i = 0; i < ps.count; i += 8) {
+        ps.life[i] = 0.5f / DEFAULT_TICK_RATE;
+    }
+    ctx.entities = ps.count;
+}
+
+void RunUpdateParticles(BenchContext& ctx)
+{
+    UpdateParticles(ctx.particles, 1.0f / DEFAULT_TICK_RATE);
+}
+
+// Rings from the middle of the screen; every 8th bullet is about to leave
+void SetupUpdateBossBullets(BenchContext& ctx, int entities)
+{
+    BossBulletPool& bossBullets = ctx.world.bossBullets;
+    PoolInit(bossBullets);
+    FireBossBullets(bossBullets, SCREEN_WIDTH / 2.0f, SCREEN_HEIGHT / 2.0f, entities, 0.0f, 2.0f * PI / entities, 240.0f);
+    for (int i = 0; i < bossBullets.count; i += 8) {
+        bossBullets.cols.y[i] = (float)SCREEN_HEIGHT;
+    }
+    ctx.entities = bossBullets.count;
+}
+
+void RunUpdateBossBullets(BenchContext& ctx)
+{
+    UpdateBossBullets(ctx.world.bossBullets, 1.0f / DEFAULT_TICK_RATE);
+}
+
+// Prints one CSV row per benchmark and entity count. Reps scale down with
+// the entity count so every row processes roughly the same work.
+void RunMicrobenchmarks()
+{
+    const int counts[] = { 30, 1000, 10000, 100000 };
+    const long long ENTITIES_PER_ROW = 4000000;
+    const MicroBenchmark benches[] = {
+        { "UpdateEnemies", SetupUpdateEnemies, RunUpdateEnemies },
+        { "UpdateBullets", SetupUpdateBullets, RunUpdateBullets },
+        { "BuildSpatialGrid", SetupBulletEnemyCollisions, RunBuildEnemyGrid },
+        { "CheckBulletEnemyCollisions", SetupBulletEnemyCollisions, RunBulletEnemyCollisions },
+        { "InitEnemiesForLevel", SetupInitEnemiesForLevel, RunInitEnemiesForLevel },
+        { "UpdateScoreAndLevel", SetupScoreSteady, RunUpdateScoreAndLevel },
+        { "UpdateScoreAndLevel_wave", SetupScoreWaveCleared, RunUpdateScoreAndLevel },
+        { "SerializeSnapshot", SetupSnapshot, RunSerializeSnapshot },
+        { "DeserializeSnapshot", SetupSnapshot, RunDeserializeSnapshot },
+        { "UpdateParticles", SetupUpdateParticles, RunUpdateParticles },
+        { "UpdateBossBullets", SetupUpdateBossBullets, RunUpdateBossBullets },
+    };
+
+    static BenchContext ctx;
+    const EntityCapacities capacities = { BENCH_CAPACITY, BENCH_CAPACITY, BENCH_CAPACITY };
+    GameWorld& w = ctx.world;
+    InitLevelArena(w.arena, w.enemies, w.bullets, w.bossBullets, capacities);
+    InitGame(w.game, w.player, w.enemies, w.bullets, w.boss, w.bossBullets, w.arena, BENCH_SEED, DefaultBalance());
+    RngSeed(ctx.rng, BENCH_SEED, RNG_STREAM_COUNT);
+    InitBroadphase(w.broadphase, capacities);
+    ctx.snapshot.resize(SnapshotMaxBytes(w.enemies, w.bullets, w.bossBullets));
+
+    cout << "benchmark,entities,reps,ns_per_call,ns_per_entity,cycles_per_entity,allocs_per_call\n";
+
+    for (const MicroBenchmark& bench : benches) {
+        for (int n : counts) {
+            long long reps = ENTITIES_PER_ROW / n;
+            if (reps < 10) reps = 10;
+
+            double ns = 0.0;
+            unsigned long long cycles = 0;
+            long long allocs = 0;
+            int entities = 0;
+
+            for (long long r = 0; r < reps; r++) {
+                bench.setup(ctx, n);
+                entities = ctx.entities;
+
+                long long allocsBefore = allocationCount;
+                auto t0 = chrono::steady_clock::now();
+                unsigned long long c0 = ReadCycleCounter();
+                bench.run(ctx);
+                unsigned long long c1 = ReadCycleCounter();
+                auto t1 = chrono::steady_clock::now();
+
+                ns += chrono::duration<double, nano>(t1 - t0).count();
+                cycles += c1 - c0;
+                allocs += allocationCount - allocsBefore;
+            }
+
+            cout << bench.name << ','
+                << entities << ','
+                << reps << ','
+                << ns / reps << ','
+                << ns / reps / entities << ','
+                << (double)cycles / reps / entities << ','
+                << (double)allocs / reps << '\n';
+        }
+    }
+}
+#endif